@@ -0,0 +1,748 @@
+// Benchmark.cpp
+
+// Performance benchmarks for the whole pipeline, built as a program of their own
+// (Benchmark.vcxproj) so the P4 demo is left alone:
+//  - micro benchmarks for ExpandableHashMap, StreetMap::load and getSegmentsThatStartWith
+//  - macro benchmarks for PointToPointRouter in each mode, and for DeliveryOptimizer and
+//    DeliveryPlanner at several order sizes; each optimizer engine's line is followed by
+//    an optimizer_trip line with the mean trip length it started from and ended with
+// Every query comes from a QueryGenerator seeded from the command line, so two builds
+// given the same seed measure exactly the same work.
+//
+// Usage: Benchmark [--map mapdata.txt] [--seed 1] [--scale 1]
+// --scale multiplies the number of samples. Progress goes to cerr; cout gets one JSON
+// object per line, first a description of the run and then one per benchmark:
+//   {"benchmark":"router","mode":"astar","samples":200,"ops":200,"p50_us":...,"p90_us":...,
+//    "p99_us":...,"max_us":...,"mean_us":...,"ops_per_s":...}
+// A sample is one timed call, or one timed batch of calls for the micro benchmarks whose
+// calls are too quick to time one at a time. The percentiles are of the time per call
+// within a sample; ops_per_s is the calls over the time of every sample together.
+//
+// Benchmark --check [--map mapdata.txt] [--seed 1] [--scale 1] times nothing and instead
+// compares the fast paths with slow references on the same seeded queries, one line each:
+//   {"benchmark":"check","name":"held_karp","cases":50,"mismatches":0}
+//  - held_karp: Held-Karp's trip against the shortest of every order
+//  - local_search: the trip length LocalSearch scored move by move against the trip's real length
+//  - optimizer: each engine's reported lengths against its order's, and that it only ever shortens
+//  - snapshot: a map saved as a snapshot and loaded back against the map, node by node and edge by edge
+//  - router: each mode, and A* and bidirectional search with landmarks, against plain A*
+// and exits with 1 if any check found a mismatch.
+
+#include "provided.h"
+#include "ExpandableHashMap.h"
+#include "StreetGraph.h"
+#include "RouteCache.h"
+#include "RouterMode.h"
+#include "OptimizerEngine.h"
+#include "MapParser.h"
+#include "CrowDistance.h"
+#include "WorkerPool.h"
+#include "TourSearch.h"
+#include <vector>
+#include <list>
+#include <string>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <utility>
+#include <iostream>
+#include <sstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+using namespace std;
+
+namespace
+{
+	typedef StreetGraph::NodeId NodeId;
+	typedef chrono::steady_clock Clock;
+
+	// Results are added up here so the compiler can't drop the work being timed
+	volatile double g_sink = 0;
+
+	// Extra "name":value pairs for a benchmark's line; values are already JSON
+	typedef vector<pair<string, string>> Fields;
+
+	string quoted(const string& s)
+	{
+		string result = "\"";
+		for (char c : s) {
+			if (c == '"' || c == '\\') {
+				result += '\\';
+			}
+			result += c;
+		}
+		return result + "\"";
+	}
+
+	string number(double value)
+	{
+		char buffer[32];
+		snprintf(buffer, sizeof(buffer), "%.3f", value);
+		return buffer;
+	}
+
+	string number(long long value)
+	{
+		return to_string(value);
+	}
+
+	void printLine(const string& benchmark, const Fields& fields)
+	{
+		cout << "{\"benchmark\":" << quoted(benchmark);
+		for (const auto& field : fields) {
+			cout << "," << quoted(field.first) << ":" << field.second;
+		}
+		cout << "}" << endl;
+	}
+
+	// Nearest-rank percentile p (0 to 100) of sorted values
+	double percentile(const vector<double>& sorted, double p)
+	{
+		if (sorted.empty()) {
+			return 0;
+		}
+		size_t rank = (size_t)(p / 100 * sorted.size() + 0.999999);
+		return sorted[min(max(rank, (size_t)1), sorted.size()) - 1];
+	}
+
+	// Times run(i) for each sample i from 0 to samples - 1, each making opsPerSample calls,
+	// and prints the benchmark's line. prepare(i), if given, is called before run(i) and isn't timed.
+	void measure(const string& benchmark, Fields fields, int samples, int opsPerSample,
+		const function<void(int)>& run, const function<void(int)>& prepare = nullptr)
+	{
+		cerr << benchmark;
+		for (const auto& field : fields) {
+			cerr << " " << field.first << "=" << field.second;
+		}
+		cerr << endl;
+
+		vector<double> perOp;
+		double totalMicroseconds = 0;
+		for (int i = 0; i < samples; ++i) {
+			if (prepare) {
+				prepare(i);
+			}
+			Clock::time_point started = Clock::now();
+			run(i);
+			double microseconds = chrono::duration<double, micro>(Clock::now() - started).count();
+			totalMicroseconds += microseconds;
+			perOp.push_back(microseconds / opsPerSample);
+		}
+		sort(perOp.begin(), perOp.end());
+		long long ops = (long long)samples * opsPerSample;
+		double mean = ops == 0 ? 0 : totalMicroseconds / ops;
+
+		fields.push_back(make_pair("samples", number((long long)samples)));
+		fields.push_back(make_pair("ops", number(ops)));
+		fields.push_back(make_pair("p50_us", number(percentile(perOp, 50))));
+		fields.push_back(make_pair("p90_us", number(percentile(perOp, 90))));
+		fields.push_back(make_pair("p99_us", number(percentile(perOp, 99))));
+		fields.push_back(make_pair("max_us", number(perOp.empty() ? 0 : perOp.back())));
+		fields.push_back(make_pair("mean_us", number(mean)));
+		fields.push_back(make_pair("ops_per_s", number(totalMicroseconds == 0 ? 0 : ops / totalMicroseconds * 1e6)));
+		printLine(benchmark, fields);
+	}
+
+	// Random queries over a map, the same ones for the same seed. Positions are vertices of the
+	// map's largest connected part, so any two of them have a route between them. Numbers are
+	// taken straight from mt19937, whose output the standard fixes, rather than through a
+	// distribution, whose output differs from one standard library to another.
+	class QueryGenerator
+	{
+	public:
+		QueryGenerator(const StreetGraph* graph, unsigned int seed);
+		unsigned int candidates() const { return (unsigned int)m_nodes.size(); }
+		GeoCoord location();
+		// Two different locations
+		void pair(GeoCoord& start, GeoCoord& end);
+		// count deliveries, with their depot
+		void order(int count, GeoCoord& depot, vector<DeliveryRequest>& deliveries);
+	private:
+		const StreetGraph* m_graph;
+		mt19937 m_rng;
+		vector<NodeId> m_nodes; // the largest connected part
+
+		NodeId node() { return m_nodes[m_rng() % m_nodes.size()]; }
+	};
+
+	QueryGenerator::QueryGenerator(const StreetGraph* graph, unsigned int seed) : m_graph(graph), m_rng(seed)
+	{
+		// Label the connected parts by depth-first search; streets run both ways on the map
+		const unsigned int NONE = (unsigned int)-1;
+		vector<unsigned int> part(graph->nodeCount(), NONE);
+		vector<unsigned int> sizes;
+		vector<NodeId> stack;
+		for (NodeId start = 0; start < graph->nodeCount(); ++start) {
+			if (part[start] != NONE) {
+				continue;
+			}
+			unsigned int label = (unsigned int)sizes.size();
+			sizes.push_back(0);
+			part[start] = label;
+			stack.push_back(start);
+			while (!stack.empty()) {
+				NodeId u = stack.back();
+				stack.pop_back();
+				++sizes[label];
+				for (const StreetGraph::EdgeView& e : graph->edges(u)) {
+					if (part[e.target] == NONE) {
+						part[e.target] = label;
+						stack.push_back(e.target);
+					}
+				}
+			}
+		}
+		if (sizes.empty()) {
+			return;
+		}
+		unsigned int largest = (unsigned int)(max_element(sizes.begin(), sizes.end()) - sizes.begin());
+		for (NodeId u = 0; u < graph->nodeCount(); ++u) {
+			if (part[u] == largest) {
+				m_nodes.push_back(u);
+			}
+		}
+	}
+
+	GeoCoord QueryGenerator::location()
+	{
+		return m_graph->coord(node());
+	}
+
+	void QueryGenerator::pair(GeoCoord& start, GeoCoord& end)
+	{
+		NodeId from = node();
+		NodeId to = node();
+		while (to == from && m_nodes.size() > 1) {
+			to = node();
+		}
+		start = m_graph->coord(from);
+		end = m_graph->coord(to);
+	}
+
+	void QueryGenerator::order(int count, GeoCoord& depot, vector<DeliveryRequest>& deliveries)
+	{
+		depot = location();
+		deliveries.clear();
+		for (int i = 0; i < count; ++i) {
+			deliveries.push_back(DeliveryRequest("Item " + to_string(i + 1), location()));
+		}
+	}
+
+	const char* modeName(RouterMode mode)
+	{
+		switch (mode) {
+		case ROUTER_ASTAR:
+			return "astar";
+		case ROUTER_BIDIRECTIONAL:
+			return "bidirectional";
+		case ROUTER_CONTRACTION_HIERARCHY:
+			return "contraction_hierarchy";
+		}
+		return "unknown";
+	}
+
+	const char* engineName(OptimizerEngine engine)
+	{
+		switch (engine) {
+		case OPTIMIZER_ANNEALING:
+			return "annealing";
+		case OPTIMIZER_LOCAL_SEARCH:
+			return "local_search";
+		case OPTIMIZER_PARALLEL_TEMPERING:
+			return "parallel_tempering";
+		case OPTIMIZER_CLUSTERED:
+			return "clustered";
+		}
+		return "unknown";
+	}
+
+	void hashMapBenchmarks(const StreetGraph* graph, QueryGenerator& queries, int scale)
+	{
+		// Keys like the ones the map used to be indexed by: every vertex's coordinate text
+		vector<string> keys;
+		for (NodeId u = 0; u < graph->nodeCount(); ++u) {
+			GeoCoord gc = graph->coord(u);
+			keys.push_back(gc.latitudeText + "," + gc.longitudeText);
+		}
+		int n = (int)keys.size();
+
+		unique_ptr<ExpandableHashMap<string, int>> map;
+		measure("ehm_associate", Fields{ make_pair("keys", number((long long)n)) }, 10 * scale, n,
+			[&](int) {
+				for (int i = 0; i < n; ++i) {
+					map->associate(keys[i], i);
+				}
+			},
+			[&](int) { map.reset(new ExpandableHashMap<string, int>()); });
+
+		// Half the lookups are for keys that aren't there
+		const int LOOKUPS = 10000;
+		vector<string> probes;
+		for (int i = 0; i < LOOKUPS; ++i) {
+			GeoCoord gc = queries.location();
+			probes.push_back(gc.latitudeText + "," + gc.longitudeText + (i % 2 == 0 ? "" : "0"));
+		}
+		measure("ehm_find", Fields{ make_pair("keys", number((long long)n)) }, 20 * scale, LOOKUPS,
+			[&](int) {
+				long long found = 0;
+				for (const string& probe : probes) {
+					found += map->find(probe) != nullptr;
+				}
+				g_sink = g_sink + found;
+			});
+	}
+
+	void streetMapBenchmarks(const string& mapFile, const StreetMap& sm, QueryGenerator& queries, int scale)
+	{
+		MapLoadStats stats;
+		measure("map_load", Fields{ make_pair("map", quoted(mapFile)) }, 5 * scale, 1,
+			[&](int) {
+				StreetMap loaded;
+				if (!loaded.load(mapFile)) {
+					cerr << "Error: couldn't load " << mapFile << endl;
+					exit(1);
+				}
+				stats = loaded.lastLoadStats();
+			});
+		printLine("map_load_stats", Fields{
+			make_pair("bytes", number((long long)stats.bytes)),
+			make_pair("segments", number((long long)stats.segments)),
+			make_pair("chunks", number((long long)stats.chunks)),
+			make_pair("parse_ms", number(stats.parseMilliseconds)),
+			make_pair("megabytes_per_s", number(stats.megabytesPerSecond)) });
+
+		const int LOOKUPS = 1000;
+		vector<GeoCoord> points;
+		for (int i = 0; i < LOOKUPS; ++i) {
+			points.push_back(queries.location());
+		}
+		measure("segments_that_start_with", Fields{}, 20 * scale, LOOKUPS,
+			[&](int) {
+				vector<StreetSegment> segs;
+				size_t found = 0;
+				for (const GeoCoord& gc : points) {
+					sm.getSegmentsThatStartWith(gc, segs);
+					found += segs.size();
+				}
+				g_sink = g_sink + found;
+			});
+		measure("visit_segments_that_start_with", Fields{}, 20 * scale, LOOKUPS,
+			[&](int) {
+				double miles = 0;
+				for (const GeoCoord& gc : points) {
+					sm.visitSegmentsThatStartWith(gc, [&](const StreetEdgeRef& ref) { miles += ref.miles; });
+				}
+				g_sink = g_sink + miles;
+			});
+	}
+
+	void routerBenchmarks(StreetMap& sm, QueryGenerator& queries, int scale)
+	{
+		measure("contraction_hierarchy_build", Fields{}, 1, 1, [&](int) { sm.buildContractionHierarchy(); });
+
+		int samples = 200 * scale;
+		vector<GeoCoord> starts(samples), ends(samples);
+		for (int i = 0; i < samples; ++i) {
+			queries.pair(starts[i], ends[i]);
+		}
+		const RouterMode MODES[] = { ROUTER_ASTAR, ROUTER_BIDIRECTIONAL, ROUTER_CONTRACTION_HIERARCHY };
+		for (RouterMode mode : MODES) {
+			// Without a route cache, so every query is a search
+			PointToPointRouter router(&sm);
+			router.setMode(mode);
+			long long failed = 0;
+			list<StreetSegment> route;
+			measure("router", Fields{ make_pair("mode", quoted(modeName(mode))) }, samples, 1,
+				[&](int i) {
+					double distance = 0;
+					if (router.generatePointToPointRoute(starts[i], ends[i], route, distance) != DELIVERY_SUCCESS) {
+						++failed;
+					}
+					g_sink = g_sink + distance;
+				});
+			if (failed != 0) {
+				cerr << "Error: " << failed << " " << modeName(mode) << " queries found no route" << endl;
+			}
+		}
+	}
+
+	// Every engine gets the same orders, so their trips can be compared as well as their times
+	void optimizerBenchmarks(const StreetMap& sm, QueryGenerator& queries, unsigned int seed, int scale)
+	{
+		const int SIZES[] = { 10, 50, 200 };
+		const OptimizerEngine ENGINES[] = { OPTIMIZER_ANNEALING, OPTIMIZER_LOCAL_SEARCH, OPTIMIZER_PARALLEL_TEMPERING };
+		for (int size : SIZES) {
+			int samples = 20 * scale;
+			vector<GeoCoord> depots(samples);
+			vector<vector<DeliveryRequest>> orders(samples);
+			for (int i = 0; i < samples; ++i) {
+				queries.order(size, depots[i], orders[i]);
+			}
+			for (OptimizerEngine engine : ENGINES) {
+				DeliveryOptimizer optimizer(&sm);
+				optimizer.setEngine(engine);
+				optimizer.setSeed(seed);
+				// Tempering's trips depend on its chain count, so fix it rather than take the machine's
+				optimizer.setChains(4);
+				vector<vector<DeliveryRequest>> optimized = orders;
+				double oldTotal = 0;
+				double newTotal = 0;
+				measure("optimizer", Fields{ make_pair("engine", quoted(engineName(engine))), make_pair("stops", number((long long)size)) },
+					samples, 1,
+					[&](int i) {
+						double oldDistance, newDistance;
+						optimizer.optimizeDeliveryOrder(depots[i], optimized[i], oldDistance, newDistance);
+						oldTotal += oldDistance;
+						newTotal += newDistance;
+					});
+				// Mean crow-flies miles of the trips before and after
+				printLine("optimizer_trip", Fields{
+					make_pair("engine", quoted(engineName(engine))),
+					make_pair("stops", number((long long)size)),
+					make_pair("old_miles", number(oldTotal / samples)),
+					make_pair("new_miles", number(newTotal / samples)) });
+				g_sink = g_sink + newTotal;
+			}
+		}
+	}
+
+	void plannerBenchmarks(const StreetMap& sm, QueryGenerator& queries, int scale)
+	{
+		const int SIZES[] = { 1, 5, 20 };
+		DeliveryPlanner planner(&sm);
+		for (int size : SIZES) {
+			int samples = 20 * scale;
+			vector<GeoCoord> depots(samples);
+			vector<vector<DeliveryRequest>> orders(samples);
+			for (int i = 0; i < samples; ++i) {
+				queries.order(size, depots[i], orders[i]);
+			}
+			long long failed = 0;
+			vector<DeliveryCommand> commands;
+			// Each plan starts with an empty route cache, as a new order would
+			measure("planner", Fields{ make_pair("deliveries", number((long long)size)) }, samples, 1,
+				[&](int i) {
+					double distance = 0;
+					if (planner.generateDeliveryPlan(depots[i], orders[i], commands, distance) != DELIVERY_SUCCESS) {
+						++failed;
+					}
+					g_sink = g_sink + distance;
+				},
+				[&](int) {
+					if (sm.routeCache() != nullptr) {
+						sm.routeCache()->clear();
+					}
+				});
+			if (failed != 0) {
+				cerr << "Error: " << failed << " plans of " << size << " deliveries failed" << endl;
+			}
+		}
+	}
+
+	// Lengths worked out two ways agree to rounding
+	bool sameLength(double a, double b)
+	{
+		return fabs(a - b) <= 1e-9 * max(1.0, fabs(b));
+	}
+
+	// Prints a check's line; true if it found no mismatches
+	bool report(const string& name, long long cases, long long mismatches)
+	{
+		printLine("check", Fields{ make_pair("name", quoted(name)), make_pair("cases", number(cases)), make_pair("mismatches", number(mismatches)) });
+		if (mismatches != 0) {
+			cerr << "Error: " << mismatches << " of " << cases << " " << name << " cases don't match" << endl;
+		}
+		return mismatches == 0;
+	}
+
+	// An order's stops as TourSearch numbers them: the depot, then the deliveries
+	vector<GeoCoord> stopLocations(const GeoCoord& depot, const vector<DeliveryRequest>& deliveries)
+	{
+		vector<GeoCoord> locations(1, depot);
+		for (const DeliveryRequest& d : deliveries) {
+			locations.push_back(d.location);
+		}
+		return locations;
+	}
+
+	// Whether order visits each of stops 1 to count exactly once
+	bool visitsAll(vector<int> order, int count)
+	{
+		sort(order.begin(), order.end());
+		for (int i = 0; i < count; ++i) {
+			if (i >= (int)order.size() || order[i] != i + 1) {
+				return false;
+			}
+		}
+		return (int)order.size() == count;
+	}
+
+	bool checkHeldKarp(QueryGenerator& queries, int scale)
+	{
+		int cases = 50 * scale;
+		long long mismatches = 0;
+		for (int c = 0; c < cases; ++c) {
+			int size = 2 + c % 7; // up to 8 deliveries, 40320 orders
+			GeoCoord depot;
+			vector<DeliveryRequest> deliveries;
+			queries.order(size, depot, deliveries);
+			vector<GeoCoord> locations = stopLocations(depot, deliveries);
+			vector<int> stops(size + 1);
+			iota(stops.begin(), stops.end(), 0);
+			StopDistances dist(locations, nullptr, stops);
+
+			vector<int> order(stops.begin() + 1, stops.end());
+			HeldKarp solver(dist);
+			solver.solve(order);
+			vector<int> permutation(stops.begin() + 1, stops.end());
+			double shortest = numeric_limits<double>::infinity();
+			do {
+				shortest = min(shortest, dist.tripLength(permutation));
+			} while (next_permutation(permutation.begin(), permutation.end()));
+			if (!visitsAll(order, size) || !sameLength(dist.tripLength(order), shortest)) {
+				++mismatches;
+			}
+		}
+		return report("held_karp", cases, mismatches);
+	}
+
+	// Every 2-opt, Or-opt and or-3opt move adds its scored change to the search's length, so
+	// a wrong change anywhere shows up as a length that isn't the trip's
+	bool checkLocalSearch(QueryGenerator& queries, int scale)
+	{
+		const int SIZES[] = { 5, 12, 50, 200, 1000 };
+		int cases = 0;
+		long long mismatches = 0;
+		for (int size : SIZES) {
+			for (int i = 0; i < 10 * scale; ++i, ++cases) {
+				GeoCoord depot;
+				vector<DeliveryRequest> deliveries;
+				queries.order(size, depot, deliveries);
+				vector<GeoCoord> locations = stopLocations(depot, deliveries);
+				vector<int> stops(size + 1);
+				iota(stops.begin(), stops.end(), 0);
+				StopDistances dist(locations, nullptr, stops);
+
+				vector<int> order(stops.begin() + 1, stops.end());
+				double before = dist.tripLength(order);
+				LocalSearch search(dist);
+				SearchBudget budget;
+				search.improve(order, budget);
+				double after = dist.tripLength(order);
+				if (!visitsAll(order, size) || !sameLength(search.length(), after) || after > before) {
+					++mismatches;
+				}
+			}
+		}
+		return report("local_search", cases, mismatches);
+	}
+
+	bool checkOptimizer(const StreetMap& sm, QueryGenerator& queries, unsigned int seed, int scale)
+	{
+		const int SIZES[] = { 3, 10, 50, 200 };
+		const OptimizerEngine ENGINES[] = { OPTIMIZER_ANNEALING, OPTIMIZER_LOCAL_SEARCH, OPTIMIZER_PARALLEL_TEMPERING, OPTIMIZER_CLUSTERED };
+		int cases = 0;
+		long long mismatches = 0;
+		for (OptimizerEngine engine : ENGINES) {
+			DeliveryOptimizer optimizer(&sm);
+			optimizer.setEngine(engine);
+			optimizer.setSeed(seed);
+			for (int size : SIZES) {
+				for (int i = 0; i < 5 * scale; ++i, ++cases) {
+					GeoCoord depot;
+					vector<DeliveryRequest> deliveries;
+					queries.order(size, depot, deliveries);
+					vector<DeliveryRequest> optimized = deliveries;
+					double oldDistance, newDistance;
+					optimizer.optimizeDeliveryOrder(depot, optimized, oldDistance, newDistance);
+
+					vector<GeoCoord> before = stopLocations(depot, deliveries);
+					vector<GeoCoord> after = stopLocations(depot, optimized);
+					vector<int> order(size);
+					iota(order.begin(), order.end(), 1);
+					vector<int> stops(size + 1);
+					iota(stops.begin(), stops.end(), 0);
+					double oldLength = StopDistances(before, nullptr, stops).tripLength(order);
+					double newLength = StopDistances(after, nullptr, stops).tripLength(order);
+
+					// Items are numbered in order, so sorting them puts the original order back
+					vector<string> items, sorted;
+					for (int j = 0; j < size; ++j) {
+						items.push_back(deliveries[j].item);
+						sorted.push_back(optimized[j].item);
+					}
+					sort(items.begin(), items.end());
+					sort(sorted.begin(), sorted.end());
+					if ((int)optimized.size() != size || items != sorted || !sameLength(oldDistance, oldLength)
+						|| !sameLength(newDistance, newLength) || newLength > oldLength * (1 + 1e-9)) {
+						++mismatches;
+					}
+				}
+			}
+		}
+		return report("optimizer", cases, mismatches);
+	}
+
+	bool checkSnapshot(const string& mapFile, const StreetMap& sm)
+	{
+		string snapshotFile = mapFile + ".check.snapshot";
+		StreetMap loaded;
+		bool roundTrip = sm.saveSnapshot(snapshotFile) && loaded.loadSnapshot(snapshotFile);
+		remove(snapshotFile.c_str());
+
+		const StreetGraph* graph = sm.graph();
+		const StreetGraph* copy = loaded.graph();
+		long long cases = graph->nodeCount() + graph->nameCount();
+		long long mismatches = 0;
+		if (!roundTrip || copy->nodeCount() != graph->nodeCount() || copy->edgeCount() != graph->edgeCount()
+			|| copy->nameCount() != graph->nameCount() || copy->checksum() != graph->checksum()) {
+			return report("snapshot", cases, cases);
+		}
+		for (NodeId u = 0; u < graph->nodeCount(); ++u) {
+			bool same = copy->latitude(u) == graph->latitude(u) && copy->longitude(u) == graph->longitude(u)
+				&& copy->coord(u) == graph->coord(u) && copy->edgeBegin(u) == graph->edgeBegin(u) && copy->edgeEnd(u) == graph->edgeEnd(u)
+				&& copy->findNode(graph->coord(u)) == u;
+			for (StreetGraph::EdgeId e = graph->edgeBegin(u); same && e != graph->edgeEnd(u); ++e) {
+				same = copy->edgeTarget(e) == graph->edgeTarget(e) && copy->edgeLength(e) == graph->edgeLength(e)
+					&& copy->edgeName(e) == graph->edgeName(e);
+			}
+			if (!same) {
+				++mismatches;
+			}
+		}
+		for (StreetGraph::NameId id = 0; id < graph->nameCount(); ++id) {
+			if (copy->streetName(id) != graph->streetName(id)) {
+				++mismatches;
+			}
+		}
+		return report("snapshot", cases, mismatches);
+	}
+
+	// Whether route is a chain of segments from start to end
+	bool chained(const list<StreetSegment>& route, const GeoCoord& start, const GeoCoord& end)
+	{
+		GeoCoord at = start;
+		for (const StreetSegment& segment : route) {
+			if (!(segment.start == at)) {
+				return false;
+			}
+			at = segment.end;
+		}
+		return at == end;
+	}
+
+	bool checkRouter(StreetMap& sm, QueryGenerator& queries, int scale)
+	{
+		int cases = 100 * scale;
+		vector<GeoCoord> starts(cases), ends(cases);
+		for (int i = 0; i < cases; ++i) {
+			queries.pair(starts[i], ends[i]);
+		}
+		list<StreetSegment> route;
+		// Routes from PointToPointRouter in mode with whatever the map has been given so far;
+		// NaN where there's no route or it doesn't join up
+		auto distances = [&](RouterMode mode) {
+			PointToPointRouter router(&sm);
+			router.setMode(mode);
+			vector<double> result(cases);
+			for (int i = 0; i < cases; ++i) {
+				double distance = 0;
+				bool found = router.generatePointToPointRoute(starts[i], ends[i], route, distance) == DELIVERY_SUCCESS;
+				result[i] = found && chained(route, starts[i], ends[i]) ? distance : nan("");
+			}
+			return result;
+		};
+		auto compare = [&](const string& name, const vector<double>& expected, const vector<double>& actual) {
+			long long mismatches = 0;
+			for (int i = 0; i < cases; ++i) {
+				if (!(sameLength(actual[i], expected[i]))) {
+					++mismatches;
+				}
+			}
+			return report(name, cases, mismatches);
+		};
+
+		vector<double> astar = distances(ROUTER_ASTAR);
+		bool passed = compare("router_astar", astar, astar); // every query has a route that joins up
+		passed = compare("router_bidirectional", astar, distances(ROUTER_BIDIRECTIONAL)) && passed;
+		sm.buildContractionHierarchy();
+		passed = compare("router_contraction_hierarchy", astar, distances(ROUTER_CONTRACTION_HIERARCHY)) && passed;
+		sm.buildLandmarks();
+		passed = compare("router_astar_landmarks", astar, distances(ROUTER_ASTAR)) && passed;
+		passed = compare("router_bidirectional_landmarks", astar, distances(ROUTER_BIDIRECTIONAL)) && passed;
+		return passed;
+	}
+
+	// Runs every check; true if they all passed
+	bool selfCheck(const string& mapFile, StreetMap& sm, QueryGenerator& queries, unsigned int seed, int scale)
+	{
+		bool passed = checkHeldKarp(queries, scale);
+		passed = checkLocalSearch(queries, scale) && passed;
+		passed = checkOptimizer(sm, queries, seed, scale) && passed;
+		passed = checkSnapshot(mapFile, sm) && passed;
+		passed = checkRouter(sm, queries, scale) && passed;
+		return passed;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	string mapFile = "mapdata.txt";
+	unsigned int seed = 1;
+	int scale = 1;
+	bool check = false;
+	for (int i = 1; i < argc; ++i) {
+		string arg = argv[i];
+		if (arg == "--check") {
+			check = true;
+		}
+		else if (i + 1 < argc && arg == "--map") {
+			mapFile = argv[++i];
+		}
+		else if (i + 1 < argc && arg == "--seed") {
+			seed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+		}
+		else if (i + 1 < argc && arg == "--scale") {
+			scale = max(atoi(argv[++i]), 1);
+		}
+		else {
+			cerr << "Usage: " << argv[0] << " [--check] [--map mapdata.txt] [--seed 1] [--scale 1]" << endl;
+			return 1;
+		}
+	}
+
+	StreetMap sm;
+	if (!sm.load(mapFile)) {
+		cerr << "Error: couldn't load " << mapFile << endl;
+		return 1;
+	}
+	const StreetGraph* graph = sm.graph();
+	QueryGenerator queries(graph, seed);
+	if (queries.candidates() < 2) {
+		cerr << "Error: " << mapFile << " has too few connected vertices to benchmark" << endl;
+		return 1;
+	}
+	printLine("run", Fields{
+		make_pair("map", quoted(mapFile)),
+		make_pair("seed", number((long long)seed)),
+		make_pair("scale", number((long long)scale)),
+		make_pair("threads", number((long long)WorkerPool::shared().workerCount())),
+		make_pair("crow_kernel", quoted(crowKernelVectorized() ? "avx2" : "scalar")),
+		make_pair("nodes", number((long long)graph->nodeCount())),
+		make_pair("connected_nodes", number((long long)queries.candidates())) });
+
+	if (check) {
+		return selfCheck(mapFile, sm, queries, seed, scale) ? 0 : 1;
+	}
+	hashMapBenchmarks(graph, queries, scale);
+	streetMapBenchmarks(mapFile, sm, queries, scale);
+	routerBenchmarks(sm, queries, scale);
+	optimizerBenchmarks(sm, queries, seed, scale);
+	plannerBenchmarks(sm, queries, scale);
+	return 0;
+}
@@ -0,0 +1,397 @@
+// ContractionHierarchy.cpp
+
+#include "ContractionHierarchy.h"
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+namespace
+{
+	const unsigned int UNRANKED = 0xFFFFFFFFu;
+	// Witness searches give up after settling this many nodes. Giving up early only
+	// costs an unnecessary shortcut, never a wrong answer.
+	const unsigned int WITNESS_SETTLE_LIMIT = 200;
+
+	// Removes the first occurrence of value from v without keeping order
+	void eraseValue(vector<unsigned int>& v, unsigned int value)
+	{
+		for (size_t i = 0; i < v.size(); ++i) {
+			if (v[i] == value) {
+				v[i] = v.back();
+				v.pop_back();
+				return;
+			}
+		}
+	}
+}
+
+// Temporary state used while contracting: the remaining graph as per-node arc lists
+class ContractionHierarchy::Builder
+{
+public:
+	Builder(ContractionHierarchy& ch, const StreetGraph* graph);
+	void run();
+private:
+	ContractionHierarchy& m_ch;
+	unsigned int m_nodes;
+	// Arcs between nodes that haven't been contracted yet
+	vector<vector<unsigned int>> m_out, m_in;
+	vector<unsigned int> m_deletedNeighbors;
+	// Final search graph arcs gathered as nodes get contracted
+	vector<vector<unsigned int>> m_up, m_down;
+
+	// Witness search state
+	vector<double> m_dist;
+	vector<unsigned int> m_reached;
+	unsigned int m_witnessSearch;
+	IndexedMinHeap m_witnessHeap;
+
+	// Counts (simulate) or adds the shortcuts needed to contract v
+	unsigned int contract(NodeId v, bool simulate);
+	// Dijkstra from u over the remaining graph without v, stopping past maxDist
+	void witnessSearch(NodeId u, NodeId v, double maxDist);
+	double priority(NodeId v);
+	// Adds the shortcut inArc + outArc, replacing a heavier arc between the same two nodes
+	void addShortcut(unsigned int inArc, unsigned int outArc);
+	// Packs per-node arc lists into CSR offsets and arcs
+	static void pack(const vector<vector<unsigned int>>& lists, vector<unsigned int>& offsets, vector<unsigned int>& arcs);
+};
+
+ContractionHierarchy::Builder::Builder(ContractionHierarchy& ch, const StreetGraph* graph)
+	: m_ch(ch), m_nodes(graph->nodeCount()), m_out(m_nodes), m_in(m_nodes), m_deletedNeighbors(m_nodes, 0),
+	m_up(m_nodes), m_down(m_nodes), m_dist(m_nodes, 0), m_reached(m_nodes, 0), m_witnessSearch(0), m_witnessHeap(m_nodes)
+{
+	// Start with the original edges, keeping only the shortest of any parallel edges
+	for (NodeId u = 0; u < m_nodes; ++u) {
+		for (EdgeId e = graph->edgeBegin(u); e != graph->edgeEnd(u); ++e) {
+			NodeId v = graph->edgeTarget(e);
+			if (v == u) {
+				continue;
+			}
+			bool parallel = false;
+			for (size_t i = 0; i < m_out[u].size(); ++i) {
+				Arc& existing = m_ch.m_arcs[m_out[u][i]];
+				if (existing.to == v) {
+					parallel = true;
+					if (graph->edgeLength(e) < existing.weight) {
+						existing.weight = graph->edgeLength(e);
+						existing.edge = e;
+					}
+					break;
+				}
+			}
+			if (!parallel) {
+				unsigned int a = (unsigned int)m_ch.m_arcs.size();
+				m_ch.m_arcs.push_back(Arc{ u, v, graph->edgeLength(e), e, NO_ARC, NO_ARC });
+				m_out[u].push_back(a);
+				m_in[v].push_back(a);
+			}
+		}
+	}
+}
+
+// Contracts nodes cheapest first, re-checking each node's priority when it comes off the queue
+void ContractionHierarchy::Builder::run()
+{
+	IndexedMinHeap queue(m_nodes);
+	for (NodeId v = 0; v < m_nodes; ++v) {
+		queue.pushOrDecrease(v, priority(v));
+	}
+
+	unsigned int order = 0;
+	while (!queue.empty()) {
+		NodeId v = queue.pop();
+		// Lazy update: if v got more expensive than the next candidate, put it back
+		double p = priority(v);
+		if (!queue.empty() && p > queue.topKey()) {
+			queue.pushOrDecrease(v, p);
+			continue;
+		}
+
+		contract(v, false);
+		m_ch.m_rank[v] = order++;
+
+		// v's remaining arcs all lead to higher-ranked nodes, so they're its search graph arcs
+		vector<NodeId> neighbors;
+		for (size_t i = 0; i < m_out[v].size(); ++i) {
+			unsigned int a = m_out[v][i];
+			m_up[v].push_back(a);
+			eraseValue(m_in[m_ch.m_arcs[a].to], a);
+			neighbors.push_back(m_ch.m_arcs[a].to);
+		}
+		for (size_t i = 0; i < m_in[v].size(); ++i) {
+			unsigned int a = m_in[v][i];
+			m_down[v].push_back(a);
+			eraseValue(m_out[m_ch.m_arcs[a].from], a);
+			neighbors.push_back(m_ch.m_arcs[a].from);
+		}
+		vector<unsigned int>().swap(m_out[v]);
+		vector<unsigned int>().swap(m_in[v]);
+
+		// Neighbors' priorities changed now that v is gone
+		for (size_t i = 0; i < neighbors.size(); ++i) {
+			NodeId w = neighbors[i];
+			++m_deletedNeighbors[w];
+			if (queue.contains(w)) {
+				queue.remove(w);
+				queue.pushOrDecrease(w, priority(w));
+			}
+		}
+	}
+
+	pack(m_up, m_ch.m_upOffsets, m_ch.m_upArcs);
+	pack(m_down, m_ch.m_downOffsets, m_ch.m_downArcs);
+}
+
+// Edge difference plus the number of already contracted neighbors, which spreads contraction evenly
+double ContractionHierarchy::Builder::priority(NodeId v)
+{
+	int shortcuts = (int)contract(v, true);
+	int removed = (int)(m_in[v].size() + m_out[v].size());
+	return double(shortcuts - removed + (int)m_deletedNeighbors[v]);
+}
+
+// For every pair u -> v -> w, a shortcut is needed unless a witness path u -> w avoiding v is no longer
+unsigned int ContractionHierarchy::Builder::contract(NodeId v, bool simulate)
+{
+	unsigned int shortcuts = 0;
+	// Copy the arc lists: adding shortcuts can change m_in / m_out of the neighbors
+	vector<unsigned int> inArcs = m_in[v];
+	vector<unsigned int> outArcs = m_out[v];
+	for (size_t i = 0; i < inArcs.size(); ++i) {
+		const Arc inArc = m_ch.m_arcs[inArcs[i]];
+		NodeId u = inArc.from;
+
+		// Search only as far as the longest path through v that would need a shortcut
+		double maxDist = 0;
+		for (size_t j = 0; j < outArcs.size(); ++j) {
+			const Arc& outArc = m_ch.m_arcs[outArcs[j]];
+			if (outArc.to != u) {
+				maxDist = max(maxDist, inArc.weight + outArc.weight);
+			}
+		}
+		witnessSearch(u, v, maxDist);
+
+		for (size_t j = 0; j < outArcs.size(); ++j) {
+			const Arc& outArc = m_ch.m_arcs[outArcs[j]];
+			NodeId w = outArc.to;
+			if (w == u) {
+				continue;
+			}
+			double viaV = inArc.weight + outArc.weight;
+			if (m_reached[w] == m_witnessSearch && m_dist[w] <= viaV) {
+				continue;
+			}
+			++shortcuts;
+			if (!simulate) {
+				addShortcut(inArcs[i], outArcs[j]);
+			}
+		}
+	}
+	return shortcuts;
+}
+
+// Plain Dijkstra over the remaining graph, skipping v
+void ContractionHierarchy::Builder::witnessSearch(NodeId u, NodeId v, double maxDist)
+{
+	++m_witnessSearch;
+	m_witnessHeap.clear();
+	m_dist[u] = 0;
+	m_reached[u] = m_witnessSearch;
+	m_witnessHeap.pushOrDecrease(u, 0);
+
+	unsigned int settled = 0;
+	while (!m_witnessHeap.empty() && settled < WITNESS_SETTLE_LIMIT) {
+		if (m_witnessHeap.topKey() > maxDist) {
+			break;
+		}
+		NodeId x = m_witnessHeap.pop();
+		++settled;
+		for (size_t i = 0; i < m_out[x].size(); ++i) {
+			const Arc& arc = m_ch.m_arcs[m_out[x][i]];
+			NodeId y = arc.to;
+			if (y == v) {
+				continue;
+			}
+			double d = m_dist[x] + arc.weight;
+			if (m_reached[y] != m_witnessSearch || d < m_dist[y]) {
+				m_reached[y] = m_witnessSearch;
+				m_dist[y] = d;
+				m_witnessHeap.pushOrDecrease(y, d);
+			}
+		}
+	}
+}
+
+void ContractionHierarchy::Builder::addShortcut(unsigned int inArc, unsigned int outArc)
+{
+	NodeId u = m_ch.m_arcs[inArc].from;
+	NodeId w = m_ch.m_arcs[outArc].to;
+	double weight = m_ch.m_arcs[inArc].weight + m_ch.m_arcs[outArc].weight;
+	unsigned int a = (unsigned int)m_ch.m_arcs.size();
+	m_ch.m_arcs.push_back(Arc{ u, w, weight, NO_ARC, inArc, outArc });
+	++m_ch.m_shortcuts;
+
+	// There's at most one arc u -> w; a heavier one is replaced by the shortcut
+	for (size_t i = 0; i < m_out[u].size(); ++i) {
+		unsigned int old = m_out[u][i];
+		if (m_ch.m_arcs[old].to == w) {
+			m_out[u][i] = a;
+			for (size_t j = 0; j < m_in[w].size(); ++j) {
+				if (m_in[w][j] == old) {
+					m_in[w][j] = a;
+					break;
+				}
+			}
+			return;
+		}
+	}
+	m_out[u].push_back(a);
+	m_in[w].push_back(a);
+}
+
+void ContractionHierarchy::Builder::pack(const vector<vector<unsigned int>>& lists, vector<unsigned int>& offsets, vector<unsigned int>& arcs)
+{
+	offsets.assign(lists.size() + 1, 0);
+	arcs.clear();
+	for (size_t u = 0; u < lists.size(); ++u) {
+		arcs.insert(arcs.end(), lists[u].begin(), lists[u].end());
+		offsets[u + 1] = (unsigned int)arcs.size();
+	}
+}
+
+//******************** ContractionHierarchy functions *************************
+
+const unsigned int ContractionHierarchy::NO_ARC;
+
+ContractionHierarchy::ContractionHierarchy() : m_shortcuts(0)
+{
+}
+
+void ContractionHierarchy::build(const StreetGraph* graph)
+{
+	clear();
+	m_rank.assign(graph->nodeCount(), UNRANKED);
+	Builder builder(*this, graph);
+	builder.run();
+}
+
+void ContractionHierarchy::clear()
+{
+	vector<Arc>().swap(m_arcs);
+	vector<unsigned int>().swap(m_rank);
+	vector<unsigned int>().swap(m_upOffsets);
+	vector<unsigned int>().swap(m_upArcs);
+	vector<unsigned int>().swap(m_downOffsets);
+	vector<unsigned int>().swap(m_downArcs);
+	m_shortcuts = 0;
+}
+
+// Expands shortcuts depth first so the original edges come out in travel order
+void ContractionHierarchy::unpack(unsigned int a, vector<PathEdge>& path) const
+{
+	vector<unsigned int> stack(1, a);
+	while (!stack.empty()) {
+		const Arc& arc = m_arcs[stack.back()];
+		stack.pop_back();
+		if (arc.edge != NO_ARC) {
+			path.push_back(PathEdge{ arc.from, arc.edge });
+		}
+		else {
+			stack.push_back(arc.second);
+			stack.push_back(arc.first);
+		}
+	}
+}
+
+//******************** ContractionHierarchy::Query functions ******************
+
+ContractionHierarchy::Query::Query() : m_search(0)
+{
+}
+
+// Bidirectional upward Dijkstra: forward from s over m_up, backward from t over m_down
+bool ContractionHierarchy::Query::run(const ContractionHierarchy& ch, NodeId s, NodeId t, vector<PathEdge>& path, double& distance)
+{
+	path.clear();
+	distance = 0;
+	if (s == t) {
+		return true;
+	}
+
+	// Fit the state to the hierarchy and start a new search number
+	unsigned int nodes = ch.nodeCount();
+	bool fresh = m_labels[0].size() != nodes || m_search == 0xFFFFFFFFu;
+	for (int d = 0; d < 2; ++d) {
+		m_heaps[d].clear();
+		if (fresh) {
+			m_labels[d].assign(nodes, Label{ 0, NO_ARC, 0 });
+			m_heaps[d].resize(nodes);
+		}
+	}
+	if (fresh) {
+		m_search = 0;
+	}
+	++m_search;
+
+	const vector<unsigned int>* offsets[2] = { &ch.m_upOffsets, &ch.m_downOffsets };
+	const vector<unsigned int>* arcs[2] = { &ch.m_upArcs, &ch.m_downArcs };
+	NodeId roots[2] = { s, t };
+	for (int d = 0; d < 2; ++d) {
+		m_labels[d][roots[d]] = Label{ 0, NO_ARC, m_search };
+		m_heaps[d].pushOrDecrease(roots[d], 0);
+	}
+
+	double best = 0;
+	NodeId meet = StreetGraph::NO_NODE;
+	for (;;) {
+		// A direction is finished once its smallest key can't improve on the best meeting
+		bool active[2];
+		for (int d = 0; d < 2; ++d) {
+			active[d] = !m_heaps[d].empty() && (meet == StreetGraph::NO_NODE || m_heaps[d].topKey() < best);
+		}
+		if (!active[0] && !active[1]) {
+			break;
+		}
+		int d = (active[0] && (!active[1] || m_heaps[0].topKey() <= m_heaps[1].topKey())) ? 0 : 1;
+
+		NodeId u = m_heaps[d].pop();
+		double du = m_labels[d][u].dist;
+		// Check whether the other direction has been here
+		const Label& other = m_labels[1 - d][u];
+		if (other.search == m_search && (meet == StreetGraph::NO_NODE || du + other.dist < best)) {
+			best = du + other.dist;
+			meet = u;
+		}
+
+		for (unsigned int i = (*offsets[d])[u]; i != (*offsets[d])[u + 1]; ++i) {
+			unsigned int a = (*arcs[d])[i];
+			const Arc& arc = ch.m_arcs[a];
+			NodeId v = d == 0 ? arc.to : arc.from;
+			double dv = du + arc.weight;
+			Label& label = m_labels[d][v];
+			if (label.search != m_search || dv < label.dist) {
+				label = Label{ dv, a, m_search };
+				m_heaps[d].pushOrDecrease(v, dv);
+			}
+		}
+	}
+	if (meet == StreetGraph::NO_NODE) {
+		return false;
+	}
+
+	// Forward half: parent arcs lead from meet back to s, so collect them and reverse
+	vector<unsigned int> forwardArcs;
+	for (NodeId n = meet; m_labels[0][n].parentArc != NO_ARC; n = ch.m_arcs[m_labels[0][n].parentArc].from) {
+		forwardArcs.push_back(m_labels[0][n].parentArc);
+	}
+	for (size_t i = forwardArcs.size(); i > 0; --i) {
+		ch.unpack(forwardArcs[i - 1], path);
+	}
+	// Backward half: parent arcs already lead from meet towards t
+	for (NodeId n = meet; m_labels[1][n].parentArc != NO_ARC; n = ch.m_arcs[m_labels[1][n].parentArc].to) {
+		ch.unpack(m_labels[1][n].parentArc, path);
+	}
+	distance = best;
+	return true;
+}
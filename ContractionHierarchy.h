@@ -0,0 +1,89 @@
+#ifndef CH_H_
+#define CH_H_
+
+// ContractionHierarchy.h
+
+// Contraction hierarchy over a StreetGraph. build() contracts the nodes one at a
+// time (cheapest first, by edge difference), adding a shortcut arc u -> w whenever
+// removing v would otherwise lengthen the shortest u -> w path. Every node ends up
+// with a rank, and a shortest path can then be found by a bidirectional Dijkstra
+// that only ever moves to higher-ranked nodes, which settles a few hundred nodes
+// instead of a good part of the map. Shortcuts remember the two arcs they replace,
+// so a path is unpacked back into original StreetGraph edges.
+
+#include "StreetGraph.h"
+#include "IndexedMinHeap.h"
+#include <vector>
+
+class ContractionHierarchy
+{
+public:
+	typedef StreetGraph::NodeId NodeId;
+	typedef StreetGraph::EdgeId EdgeId;
+
+	// One original edge of a path, with the node it leaves from
+	struct PathEdge {
+		NodeId from;
+		EdgeId edge;
+	};
+
+	ContractionHierarchy();
+	void build(const StreetGraph* graph); // contracts every node of graph, replacing any previous hierarchy
+	void clear();
+	bool empty() const { return m_rank.empty(); }
+	unsigned int nodeCount() const { return (unsigned int)m_rank.size(); }
+	unsigned int shortcutCount() const { return m_shortcuts; }
+
+	// Search state for queries. Each thread needs its own; the hierarchy itself is only read.
+	class Query
+	{
+	public:
+		Query();
+		// Finds the shortest path from s to t as original edges in travel order.
+		// Returns false if t can't be reached from s.
+		bool run(const ContractionHierarchy& ch, NodeId s, NodeId t, std::vector<PathEdge>& path, double& distance);
+	private:
+		// Per-node state of one search direction, valid when search matches m_search
+		struct Label {
+			double dist;
+			unsigned int parentArc; // arc the node was reached through
+			unsigned int search;
+		};
+		std::vector<Label> m_labels[2]; // forward, backward
+		IndexedMinHeap m_heaps[2];
+		unsigned int m_search;
+	};
+
+	// We prevent a ContractionHierarchy object from being copied or assigned.
+	ContractionHierarchy(const ContractionHierarchy&) = delete;
+	ContractionHierarchy& operator=(const ContractionHierarchy&) = delete;
+
+private:
+	static const unsigned int NO_ARC = 0xFFFFFFFFu;
+
+	// Original edges and shortcuts. A shortcut has edge == NO_ARC and is made of arcs first then second.
+	struct Arc {
+		NodeId from;
+		NodeId to;
+		double weight;
+		EdgeId edge;
+		unsigned int first;
+		unsigned int second;
+	};
+	std::vector<Arc> m_arcs;
+	std::vector<unsigned int> m_rank; // contraction order of each node
+	unsigned int m_shortcuts;
+
+	// Search graphs in CSR form, holding arc indices:
+	// m_up[u] are arcs u -> v with rank[v] > rank[u] (forward search from the start),
+	// m_down[v] are arcs u -> v with rank[u] > rank[v] (backward search from the end).
+	std::vector<unsigned int> m_upOffsets, m_upArcs;
+	std::vector<unsigned int> m_downOffsets, m_downArcs;
+
+	// Appends the original edges making up arc a to path, in travel order
+	void unpack(unsigned int a, std::vector<PathEdge>& path) const;
+
+	class Builder;
+};
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef CK_H_
+#define CK_H_
+
+// CoordKey.h
+
+#include <cmath>
+#include <climits>
+
+// A position as fixed-point integers: latitude and longitude each counted in units of
+// 1e-7 degree, the precision of mapdata.txt, so every map vertex has an exact key.
+// Comparing or hashing two keys takes a few integer operations instead of comparing
+// text. Positions given more precisely are rounded to the nearest unit (about 1 cm).
+struct CoordKey
+{
+	CoordKey() : latitude(NONE), longitude(NONE) {}
+	CoordKey(double latitudeDegrees, double longitudeDegrees)
+		: latitude(units(latitudeDegrees)), longitude(units(longitudeDegrees))
+	{}
+	// False for the default key and for positions too large (or NaN) to hold
+	bool valid() const { return latitude != NONE && longitude != NONE; }
+
+	long long latitude;
+	long long longitude;
+
+private:
+	static const long long NONE = LLONG_MIN;
+	static long long units(double degrees)
+	{
+		return std::fabs(degrees) < 9e11 ? std::llround(degrees * 1e7) : NONE;
+	}
+};
+
+inline
+bool operator==(const CoordKey& lhs, const CoordKey& rhs)
+{
+	return lhs.latitude == rhs.latitude && lhs.longitude == rhs.longitude;
+}
+
+inline
+bool operator!=(const CoordKey& lhs, const CoordKey& rhs)
+{
+	return !(lhs == rhs);
+}
+
+#endif
@@ -0,0 +1,159 @@
+// CrowDistance.cpp
+
+#include "CrowDistance.h"
+#include <cmath>
+#include <algorithm>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CD_AVX2 1
+#define CD_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#define CD_AVX2 1
+#define CD_TARGET_AVX2 // MSVC compiles AVX2 intrinsics without /arch:AVX2
+#else
+#define CD_AVX2 0
+#endif
+using namespace std;
+
+namespace
+{
+	// The arc in miles over a chord of the unit sphere
+	double chordToMiles(double chord)
+	{
+		return 2 * EARTH_RADIUS_MILES * asin(min(chord / 2, 1.0));
+	}
+
+	// Turns chords into arcs in place
+	void chordsToMiles(double* chords, size_t count)
+	{
+		for (size_t i = 0; i < count; ++i) {
+			chords[i] = chordToMiles(chords[i]);
+		}
+	}
+
+#if CD_AVX2
+	bool cpuHasAvx2()
+	{
+#ifdef _MSC_VER
+		// AVX2 is CPUID leaf 7 EBX bit 5, and the OS has to save the YMM registers (XCR0 bits 1 and 2)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7) {
+			return false;
+		}
+		__cpuid(info, 1);
+		if ((info[2] & (1 << 27)) == 0) {
+			return false;
+		}
+		if ((_xgetbv(0) & 6) != 6) {
+			return false;
+		}
+		__cpuidex(info, 7, 0);
+		return (info[1] & (1 << 5)) != 0;
+#else
+		return __builtin_cpu_supports("avx2") != 0;
+#endif
+	}
+
+	const bool HAS_AVX2 = cpuHasAvx2();
+
+	CD_TARGET_AVX2 void chordsToManyAvx2(double x, double y, double z, const double* xs, const double* ys, const double* zs,
+		size_t count, double* out)
+	{
+		__m256d px = _mm256_set1_pd(x), py = _mm256_set1_pd(y), pz = _mm256_set1_pd(z);
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4) {
+			__m256d dx = _mm256_sub_pd(px, _mm256_loadu_pd(xs + i));
+			__m256d dy = _mm256_sub_pd(py, _mm256_loadu_pd(ys + i));
+			__m256d dz = _mm256_sub_pd(pz, _mm256_loadu_pd(zs + i));
+			__m256d sum = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+			_mm256_storeu_pd(out + i, _mm256_sqrt_pd(sum));
+		}
+		for (; i < count; ++i) {
+			double dx = x - xs[i], dy = y - ys[i], dz = z - zs[i];
+			out[i] = sqrt(dx * dx + dy * dy + dz * dz);
+		}
+	}
+
+	// Chords between consecutive points, four legs at a time, into out[0 .. count - 2]
+	CD_TARGET_AVX2 void pathChordsAvx2(const double* xs, const double* ys, const double* zs, size_t count, double* out)
+	{
+		size_t legs = count - 1;
+		size_t i = 0;
+		for (; i + 4 <= legs; i += 4) {
+			__m256d dx = _mm256_sub_pd(_mm256_loadu_pd(xs + i + 1), _mm256_loadu_pd(xs + i));
+			__m256d dy = _mm256_sub_pd(_mm256_loadu_pd(ys + i + 1), _mm256_loadu_pd(ys + i));
+			__m256d dz = _mm256_sub_pd(_mm256_loadu_pd(zs + i + 1), _mm256_loadu_pd(zs + i));
+			__m256d sum = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), _mm256_mul_pd(dz, dz));
+			_mm256_storeu_pd(out + i, _mm256_sqrt_pd(sum));
+		}
+		for (; i < legs; ++i) {
+			double dx = xs[i + 1] - xs[i], dy = ys[i + 1] - ys[i], dz = zs[i + 1] - zs[i];
+			out[i] = sqrt(dx * dx + dy * dy + dz * dz);
+		}
+	}
+#else
+	const bool HAS_AVX2 = false;
+#endif
+}
+
+void unitVector(double latitude, double longitude, double& x, double& y, double& z)
+{
+	double lat = deg2rad(latitude);
+	double lon = deg2rad(longitude);
+	x = cos(lat) * cos(lon);
+	y = cos(lat) * sin(lon);
+	z = sin(lat);
+}
+
+void crowMilesToMany(double x, double y, double z, const double* xs, const double* ys, const double* zs,
+	size_t count, double* out)
+{
+#if CD_AVX2
+	if (HAS_AVX2) {
+		chordsToManyAvx2(x, y, z, xs, ys, zs, count, out);
+		chordsToMiles(out, count);
+		return;
+	}
+#endif
+	for (size_t i = 0; i < count; ++i) {
+		double dx = x - xs[i], dy = y - ys[i], dz = z - zs[i];
+		out[i] = chordToMiles(sqrt(dx * dx + dy * dy + dz * dz));
+	}
+}
+
+// The AVX2 path works through the legs in blocks so the chords stay in a small buffer on the stack
+double crowPathMiles(const double* xs, const double* ys, const double* zs, size_t count)
+{
+	double length = 0;
+	if (count < 2) {
+		return length;
+	}
+#if CD_AVX2
+	if (HAS_AVX2) {
+		const size_t BLOCK = 256;
+		double chords[BLOCK];
+		for (size_t first = 0; first + 1 < count; first += BLOCK) {
+			size_t points = min(BLOCK + 1, count - first);
+			pathChordsAvx2(xs + first, ys + first, zs + first, points, chords);
+			chordsToMiles(chords, points - 1);
+			for (size_t i = 0; i + 1 < points; ++i) {
+				length += chords[i];
+			}
+		}
+		return length;
+	}
+#endif
+	for (size_t i = 0; i + 1 < count; ++i) {
+		double dx = xs[i + 1] - xs[i], dy = ys[i + 1] - ys[i], dz = zs[i + 1] - zs[i];
+		length += chordToMiles(sqrt(dx * dx + dy * dy + dz * dz));
+	}
+	return length;
+}
+
+bool crowKernelVectorized()
+{
+	return HAS_AVX2;
+}
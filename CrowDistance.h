@@ -0,0 +1,58 @@
+#ifndef CD_H_
+#define CD_H_
+
+// CrowDistance.h
+
+// Crow-flies distances for callers that measure the same points over and over.
+// distanceEarthMiles converts both points to radians and takes the cosine of both
+// latitudes on every call; here those are worked out once per point instead.
+//  - crowMiles() is distanceEarthMiles from precomputed radians and cos(latitude),
+//    step for step, so it gives exactly the same result.
+//  - chordMiles() is the straight line through the Earth between two points' unit
+//    vectors. It is never longer than the distance over the surface, and under 1e-7
+//    shorter for points a few miles apart, so it's an admissible A* bound that needs
+//    no trigonometry at all. A nanomile is taken off to cover rounding.
+//  - crowMilesToMany() and crowPathMiles() do many distances at once from unit vectors
+//    kept as separate x, y and z arrays: the chords four at a time with AVX2 when the
+//    CPU has it (plain loops otherwise), then one asin each to turn chords into arcs.
+//    They agree with distanceEarthMiles to within about 1e-12 miles.
+
+#include "provided.h"
+#include <cmath>
+#include <cstddef>
+#include <algorithm>
+
+const double EARTH_RADIUS_MILES = 6371.0 / 1.609344; // the sphere distanceEarthMiles uses
+
+// Position of a point on the unit sphere
+void unitVector(double latitude, double longitude, double& x, double& y, double& z);
+
+// Same as distanceEarthMiles, from each point's latitude and longitude in radians and cos(latitude)
+inline double crowMiles(double lat1r, double lon1r, double cosLat1, double lat2r, double lon2r, double cosLat2)
+{
+	const double milesPerKm = 1 / 1.609344;
+	double u = std::sin((lat2r - lat1r) / 2);
+	double v = std::sin((lon2r - lon1r) / 2);
+	return 2.0 * 6371.0 * std::asin(std::sqrt(u * u + cosLat1 * cosLat2 * v * v)) * milesPerKm;
+}
+
+// Straight-line distance between two unit vectors, in miles on the Earth's scale; at most the crow distance
+inline double chordMiles(double x1, double y1, double z1, double x2, double y2, double z2)
+{
+	// Rounding in the unit vectors is worth about 1e-12 miles, which can put the chord of two
+	// close points a hair over their arc; taking off a constant keeps it admissible,
+	// never above crowMiles
+	const double slack = 1e-9;
+	double dx = x1 - x2, dy = y1 - y2, dz = z1 - z2;
+	return std::max(std::sqrt(dx * dx + dy * dy + dz * dz) * EARTH_RADIUS_MILES - slack, 0.0);
+}
+
+// out[i] = crow distance from (x, y, z) to (xs[i], ys[i], zs[i]) for i from 0 to count - 1
+void crowMilesToMany(double x, double y, double z, const double* xs, const double* ys, const double* zs,
+	size_t count, double* out);
+// Length of the path through points 0, 1, ..., count - 1 in that order
+double crowPathMiles(const double* xs, const double* ys, const double* zs, size_t count);
+// True if the batched functions are using AVX2 on this CPU
+bool crowKernelVectorized();
+
+#endif
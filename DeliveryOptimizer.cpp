@@ -2,9 +2,16 @@
 // 005-299-127
 
 #include "provided.h"
+#include "DistanceMatrix.h"
+#include "OptimizerEngine.h"
+#include "TourSearch.h"
+#include "WorkerPool.h"
+#include "StreetGraph.h"
 #include <vector>
+#include <memory>
 #include <math.h>
-#include <cstdlib>
+#include <random>
+#include <algorithm>
 using namespace std;
 
 class DeliveryOptimizerImpl
@@ -14,19 +21,63 @@ public:
 	DeliveryOptimizerImpl(const StreetMap* sm);
 	~DeliveryOptimizerImpl();
 	// Gets a "good enough" order of deliveries to reduce travel distance
+	// Uses crow distances if matrix is nullptr, and the matrix's road distances otherwise
 	void optimizeDeliveryOrder(
 		const GeoCoord& depot,
 		vector<DeliveryRequest>& deliveries,
-		double& oldCrowDistance,
-		double& newCrowDistance) const;
+		const DistanceMatrix* matrix,
+		double& oldDistance,
+		double& newDistance) const;
+	// The same on road distances it routes itself, only for the tables it searches
+	DeliveryResult optimizeDeliveryOrderByRoad(
+		const GeoCoord& depot,
+		vector<DeliveryRequest>& deliveries) const;
+	void setEngine(OptimizerEngine engine) { m_engine = engine; }
+	OptimizerEngine engine() const { return m_engine; }
+	OptimizerReport lastReport() const { return m_report; }
+	void setSeed(unsigned int seed) { m_seed = seed; }
+	void setChains(unsigned int chains) { m_chains = chains; }
+	void setExactLimit(int deliveries) { m_exactLimit = min(deliveries, (int)HeldKarp::MAX_STOPS); }
+	void setDeadline(double milliseconds) { m_deadline = milliseconds; }
+	void setIterationLimit(long long iterations) { m_iterationLimit = iterations; }
+	void setCancelFlag(const atomic<bool>* cancel) { m_cancel = cancel; }
+	void setProgressCallback(const function<void(const OptimizerReport&)>& progress) { m_progress = progress; }
 private:
-	// Calculates crow distance with depot and deliveries
-	double calculateCrowDistance(const GeoCoord& depot, vector<DeliveryRequest>& deliveries) const;
-	// Reverses deliveries falling between first index and second index 
-	vector<DeliveryRequest> reverseBetween(int firstIndex, int secondIndex, vector<DeliveryRequest>& deliveries) const;
+	const StreetMap* m_sm;
+	OptimizerEngine m_engine;
+	unsigned int m_seed;
+	unsigned int m_chains;
+	int m_exactLimit;
+	double m_deadline;
+	long long m_iterationLimit;
+	const atomic<bool>* m_cancel;
+	function<void(const OptimizerReport&)> m_progress;
+	mutable OptimizerReport m_report;
+	enum { CHECK_EVERY = 256 }; // annealing iterations between budget checks
+	// Each improves order (stop numbers, see TourSearch.h) within budget, adds the moves it
+	// tried to iterations and returns the number of moves it made
+	long long anneal(const StopDistances& dist, vector<int>& order, SearchBudget& budget, long long& iterations) const;
+	long long searchLocally(const StopDistances& dist, vector<int>& order, SearchBudget& budget, long long& iterations) const;
+	long long temper(const StopDistances& dist, vector<int>& order, SearchBudget& budget, long long& iterations) const;
+	// Replaces order with the nearest-neighbor order if that's shorter
+	void pickStart(const StopDistances& dist, const LocalSearch& search, vector<int>& order) const;
+	// Whether this many deliveries go to ClusterSearch; orders no bigger than one of its
+	// sectors are searched whole instead
+	bool clusters(int deliveries) const { return m_engine == OPTIMIZER_CLUSTERED && deliveries > ClusterSearch::SECTOR_STOPS; }
+	// Does the work for both forms: distances from matrix, else routed on roads, else crow-flies.
+	// Only ClusterSearch routes on roads, and it can return NO_ROUTE, leaving deliveries as they were.
+	DeliveryResult optimize(
+		const GeoCoord& depot,
+		vector<DeliveryRequest>& deliveries,
+		const DistanceMatrix* matrix,
+		const StreetMap* roads,
+		double& oldDistance,
+		double& newDistance) const;
 };
 
 DeliveryOptimizerImpl::DeliveryOptimizerImpl(const StreetMap* sm)
+	: m_sm(sm), m_engine(OPTIMIZER_ANNEALING), m_seed(1), m_chains(0), m_exactLimit(12),
+	m_deadline(0), m_iterationLimit(0), m_cancel(nullptr)
 {
 }
 
@@ -34,92 +85,257 @@ DeliveryOptimizerImpl::~DeliveryOptimizerImpl()
 {
 }
 
-// Uses simulated annealing to get better delivery order than original input
 void DeliveryOptimizerImpl::optimizeDeliveryOrder(
 	const GeoCoord& depot,
 	vector<DeliveryRequest>& deliveries,
-	double& oldCrowDistance,
-	double& newCrowDistance) const
+	const DistanceMatrix* matrix,
+	double& oldDistance,
+	double& newDistance) const
+{
+	optimize(depot, deliveries, matrix, nullptr, oldDistance, newDistance);
+}
+
+// A table of every pair is routed up front, which also finds bad coordinates and unreachable
+// stops; ClusterSearch routes its sectors and seams itself, so only the coordinates are checked
+DeliveryResult DeliveryOptimizerImpl::optimizeDeliveryOrderByRoad(
+	const GeoCoord& depot,
+	vector<DeliveryRequest>& deliveries) const
+{
+	vector<GeoCoord> locations;
+	locations.push_back(depot);
+	for (size_t i = 0; i < deliveries.size(); ++i) {
+		locations.push_back(deliveries[i].location);
+	}
+	double oldDistance, newDistance;
+	if (!clusters((int)deliveries.size())) {
+		DistanceMatrix matrix(m_sm);
+		DeliveryResult dr = matrix.compute(locations);
+		if (dr != DELIVERY_SUCCESS) {
+			return dr;
+		}
+		return optimize(depot, deliveries, &matrix, nullptr, oldDistance, newDistance);
+	}
+	const StreetGraph* graph = m_sm->graph();
+	for (size_t i = 0; i < locations.size(); ++i) {
+		if (graph->findNode(locations[i]) == StreetGraph::NO_NODE) {
+			return BAD_COORD;
+		}
+	}
+	return optimize(depot, deliveries, nullptr, m_sm, oldDistance, newDistance);
+}
+
+DeliveryResult DeliveryOptimizerImpl::optimize(
+	const GeoCoord& depot,
+	vector<DeliveryRequest>& deliveries,
+	const DistanceMatrix* matrix,
+	const StreetMap* roads,
+	double& oldDistance,
+	double& newDistance) const
+{
+	SearchBudget budget;
+	budget.setDeadline(m_deadline);
+	budget.setIterationLimit(m_iterationLimit);
+	budget.setCancelFlag(m_cancel);
+
+	// Search over stop numbers rather than copying the deliveries around
+	int n = (int)deliveries.size();
+	vector<GeoCoord> locations;
+	locations.reserve(n + 1);
+	locations.push_back(depot);
+	vector<int> order(n);
+	for (int i = 0; i < n; ++i) {
+		locations.push_back(deliveries[i].location);
+		order[i] = i + 1;
+	}
+	// The clustered engine only makes small tables of its own; everything else searches one table of every pair
+	bool clustered = clusters(n);
+	vector<int> allStops;
+	unique_ptr<ClusterSearch> clusterSearch;
+	if (clustered) {
+		clusterSearch.reset(new ClusterSearch(locations, matrix, roads));
+	}
+	else {
+		allStops.resize(n + 1);
+		for (int i = 0; i <= n; ++i) {
+			allStops[i] = i;
+		}
+	}
+	StopDistances dist(locations, matrix, allStops);
+
+	// Get old distance with the depot and initial delivery order
+	oldDistance = clustered ? clusterSearch->tripLength(order) : dist.tripLength(order);
+
+	m_report = OptimizerReport();
+	m_report.engine = m_engine;
+	m_report.stops = n;
+	m_report.oldDistance = oldDistance;
+	if (m_progress) {
+		budget.setProgress([this, &budget](long long iterations, double bestLength) {
+			m_report.newDistance = bestLength;
+			m_report.milliseconds = budget.elapsedMs();
+			m_report.iterations = iterations;
+			m_progress(m_report);
+		});
+	}
+
+	long long moves = 0;
+	long long iterations = 0;
+	bool exact = false;
+	// With fewer than 3 deliveries every order is as long as its reverse, and there's nothing to pick from
+	if (n >= 3 && n <= m_exactLimit) {
+		HeldKarp solver(dist);
+		solver.solve(order);
+		exact = true;
+	}
+	else if (n >= 3) {
+		switch (m_engine) {
+		case OPTIMIZER_ANNEALING:
+			moves = anneal(dist, order, budget, iterations);
+			break;
+		case OPTIMIZER_LOCAL_SEARCH:
+			moves = searchLocally(dist, order, budget, iterations);
+			break;
+		case OPTIMIZER_PARALLEL_TEMPERING:
+			moves = temper(dist, order, budget, iterations);
+			break;
+		case OPTIMIZER_CLUSTERED:
+			if (!clustered) {
+				moves = searchLocally(dist, order, budget, iterations);
+				break;
+			}
+			moves = clusterSearch->improve(order, budget);
+			iterations = clusterSearch->iterations();
+			if (clusterSearch->result() != DELIVERY_SUCCESS) {
+				return clusterSearch->result();
+			}
+			break;
+		}
+	}
+	// Sum the final trip leg by leg so rounding in a running total doesn't show
+	newDistance = clustered ? clusterSearch->tripLength(order) : dist.tripLength(order);
+
+	// Put the deliveries in the order found
+	vector<DeliveryRequest> reordered;
+	reordered.reserve(deliveries.size());
+	for (size_t i = 0; i < order.size(); ++i) {
+		reordered.push_back(deliveries[order[i] - 1]);
+	}
+	deliveries = reordered;
+
+	m_report.exact = exact;
+	m_report.stoppedEarly = budget.stopped();
+	m_report.newDistance = newDistance;
+	m_report.milliseconds = budget.elapsedMs();
+	m_report.iterations = iterations;
+	m_report.moves = moves;
+	return DELIVERY_SUCCESS;
+}
+
+// Uses simulated annealing to get better delivery order than original input
+// and returns the shortest order it passed through
+long long DeliveryOptimizerImpl::anneal(const StopDistances& dist, vector<int>& order, SearchBudget& budget, long long& iterations) const
 {
-	// Get old crow distance with the depot and initial delivery vector
-	oldCrowDistance = calculateCrowDistance(depot, deliveries);
-	newCrowDistance = oldCrowDistance;
+	int n = (int)order.size();
+	long long moves = 0;
+	double length = dist.tripLength(order);
+	vector<int> best = order;
+	double bestLength = length;
+
+	// Its own generator, so optimizers running at once don't share rand()'s state, and a seed gives the same order every time
+	seed_seq seed{ m_seed };
+	mt19937 rng(seed);
 
 	// Simulated annealing parameters
 	double temp = 3;
 	double coolingRate = 0.1;
 
 	// Simulated annealing to attempt to get better route
-	// Algorithm runs in O(N^3.5)
-	for (int iteration = 0; iteration < pow(deliveries.size(), 2.5); ++iteration) {
+	// Each move is scored in O(1), and only an accepted one costs O(N) to apply
+	long long planned = budget.limit((long long)ceil(pow(n, 2.5)));
+	long long iteration = 0;
+	for (; iteration < planned; ++iteration) {
+		if (iteration % CHECK_EVERY == 0 && !budget.proceed(iteration, bestLength)) {
+			break;
+		}
 
 		// Getting random first and second index to reverse all elements between them
 		int firstIndex, secondIndex;
 		// First index can be everything from -1 to n - 3 (where n is last index) so that there's a minimum 2 elements between it and second index
-		firstIndex = rand() % (deliveries.size() - 2) - 1;
+		firstIndex = (int)(rng() % (n - 2)) - 1;
 		// Second index can be everything from first index + 3 to n + 1
-		secondIndex = deliveries.size() - (rand() % (deliveries.size() - 2 - firstIndex));
-		// Reverse everything between the indexes
-		vector<DeliveryRequest> newDeliveries = reverseBetween(firstIndex, secondIndex, deliveries);
-		
-		// Get the new crow distance from this reordered deliveries
-		double newDistance = calculateCrowDistance(depot, newDeliveries);
-		
-		// If new crow distance is better than the last iteration, accept it unconditionally
-		if (newDistance < newCrowDistance) {
-			newCrowDistance = newDistance;
-			deliveries = newDeliveries;
+		secondIndex = n - (int)(rng() % (n - 2 - firstIndex));
+
+		// Reversing everything between the indexes replaces the legs a -> b and c -> d with a -> c and b -> d
+		// (index -1 and index n are the depot)
+		int a = firstIndex < 0 ? 0 : order[firstIndex];
+		int b = order[firstIndex + 1];
+		int c = order[secondIndex - 1];
+		int d = secondIndex >= n ? 0 : order[secondIndex];
+		double change = dist(a, c) + dist(b, d) - dist(a, b) - dist(c, d);
+
+		// If the new distance is better than the last iteration, accept it unconditionally
+		bool accepted = false;
+		if (change < 0) {
+			accepted = true;
 		}
 		// If it's longer...
-		else if (newDistance > newCrowDistance) {
+		else if (change > 0) {
 			// Accept Probability
-			double acceptProb = exp((newCrowDistance - newDistance) / temp);
+			double acceptProb = exp(-change / temp);
 			int accept = acceptProb * 10000;
 
 			// Use randomness to determine whether this longer route should be accepted
-			int random = rand() % 10000;
-			if (random <= accept) {
-				newCrowDistance = newDistance;
-				deliveries = newDeliveries;
+			int random = (int)(rng() % 10000);
+			accepted = random <= accept;
+		}
+		if (accepted) {
+			reverse(order.begin() + firstIndex + 1, order.begin() + secondIndex);
+			++moves;
+			length += change;
+			if (length < bestLength) {
+				best = order;
+				bestLength = length;
 			}
 		}
 		// Reduce temperature before next iteration
 		temp *= (1.0-coolingRate);
 	}
+	iterations += iteration;
+	order = best;
+	return moves;
 }
 
-double DeliveryOptimizerImpl::calculateCrowDistance(const GeoCoord& depot, vector<DeliveryRequest>& deliveries) const {
-	// Initial distance is 0
-	double distance = 0;
-
-	if (deliveries.size() == 0) {
-		return distance;
-	}
-	// Add distance from depot to first delivery
-	distance += distanceEarthMiles(depot, deliveries[0].location);
-
-	// Add distance from each delivery to next
-	for (int delivery = 0; delivery < deliveries.size() - 1; ++delivery) {
-		distance += distanceEarthMiles(deliveries[delivery].location, deliveries[delivery + 1].location);
-	}
+long long DeliveryOptimizerImpl::searchLocally(const StopDistances& dist, vector<int>& order, SearchBudget& budget, long long& iterations) const
+{
+	LocalSearch search(dist);
+	pickStart(dist, search, order);
+	long long moves = search.improve(order, budget);
+	iterations += search.iterations();
+	return moves;
+}
 
-	// Add distance from last delivery to depot
-	distance += distanceEarthMiles(deliveries[deliveries.size() - 1].location, depot);
-	return distance;
+// The chains draw from their own generators, as the annealer does.
+// The best trip they find is finished off with local search, which can only shorten it.
+long long DeliveryOptimizerImpl::temper(const StopDistances& dist, vector<int>& order, SearchBudget& budget, long long& iterations) const
+{
+	LocalSearch search(dist);
+	pickStart(dist, search, order);
+	unsigned int chains = m_chains != 0 ? m_chains : WorkerPool::shared().workerCount();
+	ParallelTempering tempering(dist, chains, m_seed);
+	long long moves = tempering.improve(order, budget);
+	moves += search.improve(order, budget);
+	iterations += tempering.iterations() + search.iterations();
+	return moves;
 }
 
-// Returns delivery vector reversing everything between first and second index in deliveries
-vector<DeliveryRequest> DeliveryOptimizerImpl::reverseBetween(int firstIndex, int secondIndex, vector<DeliveryRequest>& deliveries) const {
-	vector<DeliveryRequest> newDeliveries = deliveries;
-	// Move to midpoint between firstIndex and secondIndex and swap everything on the way
-	for (int swap = 1; swap < (secondIndex - firstIndex) / 2 + (secondIndex - firstIndex) % 2; ++swap) {
-		newDeliveries[firstIndex + swap] = deliveries[secondIndex - swap];
-		newDeliveries[secondIndex - swap] = deliveries[firstIndex + swap];
+void DeliveryOptimizerImpl::pickStart(const StopDistances& dist, const LocalSearch& search, vector<int>& order) const
+{
+	vector<int> greedy = search.nearestNeighborOrder();
+	if (dist.tripLength(greedy) < dist.tripLength(order)) {
+		order = greedy;
 	}
-	return newDeliveries;
 }
 
-
 //******************** DeliveryOptimizer functions ****************************
 
 // These functions simply delegate to DeliveryOptimizerImpl's functions.
@@ -141,5 +357,72 @@ void DeliveryOptimizer::optimizeDeliveryOrder(
 	double& oldCrowDistance,
 	double& newCrowDistance) const
 {
-	return m_impl->optimizeDeliveryOrder(depot, deliveries, oldCrowDistance, newCrowDistance);
+	return m_impl->optimizeDeliveryOrder(depot, deliveries, nullptr, oldCrowDistance, newCrowDistance);
+}
+
+void DeliveryOptimizer::optimizeDeliveryOrder(
+	const GeoCoord& depot,
+	vector<DeliveryRequest>& deliveries,
+	const DistanceMatrix& matrix,
+	double& oldDistance,
+	double& newDistance) const
+{
+	return m_impl->optimizeDeliveryOrder(depot, deliveries, &matrix, oldDistance, newDistance);
+}
+
+DeliveryResult DeliveryOptimizer::optimizeDeliveryOrderByRoad(
+	const GeoCoord& depot,
+	vector<DeliveryRequest>& deliveries) const
+{
+	return m_impl->optimizeDeliveryOrderByRoad(depot, deliveries);
+}
+
+void DeliveryOptimizer::setEngine(OptimizerEngine engine)
+{
+	m_impl->setEngine(engine);
+}
+
+OptimizerEngine DeliveryOptimizer::engine() const
+{
+	return m_impl->engine();
+}
+
+OptimizerReport DeliveryOptimizer::lastReport() const
+{
+	return m_impl->lastReport();
+}
+
+void DeliveryOptimizer::setSeed(unsigned int seed)
+{
+	m_impl->setSeed(seed);
+}
+
+void DeliveryOptimizer::setChains(unsigned int chains)
+{
+	m_impl->setChains(chains);
+}
+
+void DeliveryOptimizer::setExactLimit(int deliveries)
+{
+	m_impl->setExactLimit(deliveries);
+}
+
+void DeliveryOptimizer::setDeadline(double milliseconds)
+{
+	m_impl->setDeadline(milliseconds);
+}
+
+void DeliveryOptimizer::setIterationLimit(long long iterations)
+{
+	m_impl->setIterationLimit(iterations);
+}
+
+void DeliveryOptimizer::setCancelFlag(const atomic<bool>* cancel)
+{
+	m_impl->setCancelFlag(cancel);
+}
+
+void DeliveryOptimizer::setProgressCallback(const function<void(const OptimizerReport&)>& progress)
+{
+	m_impl->setProgressCallback(progress);
 }
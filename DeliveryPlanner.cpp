@@ -2,9 +2,38 @@
 // 005-299-127
 
 #include "provided.h"
+#include "WorkerPool.h"
+#include "StreetGraph.h"
+#include "RouterMode.h"
+#include "OptimizerEngine.h"
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <cmath>
 using namespace std;
 
+namespace
+{
+	typedef StreetGraph::NodeId NodeId;
+	typedef StreetGraph::EdgeId EdgeId;
+
+	// Direction of edge e leaving from, in radians counterclockwise from east
+	double edgeAngle(const StreetGraph* graph, NodeId from, EdgeId e)
+	{
+		NodeId to = graph->edgeTarget(e);
+		return atan2(graph->latitude(to) - graph->latitude(from), graph->longitude(to) - graph->longitude(from));
+	}
+
+	// Degrees in [0, 360), the way angleOfLine and angleBetween2Lines report them
+	double positiveDegrees(double radians)
+	{
+		double result = rad2deg(radians);
+		if (result < 0)
+			result += 360;
+		return result;
+	}
+}
+
 class DeliveryPlannerImpl
 {
 public:
@@ -17,12 +46,19 @@ public:
 		const vector<DeliveryRequest>& deliveries,
 		vector<DeliveryCommand>& commands,
 		double& totalDistanceTravelled) const;
+	void setEngine(OptimizerEngine engine) { m_optimizer.setEngine(engine); }
 private:
 	const StreetMap* m_sm;
+	DeliveryOptimizer m_optimizer;
+	// One router per pool worker, so legs can be routed at the same time
+	mutable vector<unique_ptr<PointToPointRouter>> m_routers;
+	// The routers and the optimizer's report are reused from plan to plan, so plans made
+	// from several threads take turns; each plan already routes its legs on the whole pool
+	mutable mutex m_mutex;
 };
 
 // Records StreetMap* pointer
-DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm): m_sm(sm)
+DeliveryPlannerImpl::DeliveryPlannerImpl(const StreetMap* sm): m_sm(sm), m_optimizer(sm)
 {
 }
 
@@ -37,17 +73,7 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
 	vector<DeliveryCommand>& commands,
 	double& totalDistanceTravelled) const
 {
-	// Optimized the delivery order with the DeliveryOptimizer class
-	vector<DeliveryRequest> deliveriesCopy = deliveries;
-	double originalCrowDistance, newCrowDistance;
-	DeliveryOptimizer delOp(m_sm);
-	delOp.optimizeDeliveryOrder(depot, deliveriesCopy, originalCrowDistance, newCrowDistance);
-
-	// Get routes for each part of the trip
-	list<list<StreetSegment>> routes;
-	PointToPointRouter router(m_sm);
-	list<StreetSegment> route;
-	double routeDistance;
+	lock_guard<mutex> lock(m_mutex);
 	DeliveryResult dr;
 
 	double total = 0;
@@ -59,49 +85,66 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
 		return DELIVERY_SUCCESS;
 	}
 
-	// Add route from depot to the first location
-	dr = router.generatePointToPointRoute(depot, deliveriesCopy[0].location, route, routeDistance);
-	// If not successful...
+	// Optimized the delivery order with the DeliveryOptimizer class, on road distances between
+	// the stops it compares, which also finds bad coordinates and unreachable stops before any routing
+	vector<DeliveryRequest> deliveriesCopy = deliveries;
+	dr = m_optimizer.optimizeDeliveryOrderByRoad(depot, deliveriesCopy);
 	if (dr != DELIVERY_SUCCESS) {
 		return dr;
 	}
-	// Add route and distance travelled for this part of the trip
-	routes.push_back(route);
-	total += routeDistance;
-	
-	// Add routes between all deliveries
-	for (int delivery = 0; delivery < deliveries.size() - 1; ++delivery) {
-		dr = router.generatePointToPointRoute(deliveriesCopy[delivery].location, deliveriesCopy[delivery + 1].location, route, routeDistance);
+
+	// Stops in trip order: leg i goes from stops[i] to stops[i + 1]
+	vector<GeoCoord> stops;
+	stops.push_back(depot);
+	for (size_t i = 0; i < deliveriesCopy.size(); ++i) {
+		stops.push_back(deliveriesCopy[i].location);
+	}
+	stops.push_back(depot);
+
+	// The legs are independent once the order is fixed, so route them all at once
+	WorkerPool& pool = WorkerPool::shared();
+	while (m_routers.size() < pool.workerCount()) {
+		m_routers.push_back(unique_ptr<PointToPointRouter>(new PointToPointRouter(m_sm)));
+		// Uses the map's contraction hierarchy if one was built, plain A* otherwise
+		m_routers.back()->setMode(ROUTER_CONTRACTION_HIERARCHY);
+		// Depots and popular stops come up again and again, so share routes between plans
+		m_routers.back()->setCache(m_sm->routeCache());
+	}
+	size_t legCount = stops.size() - 1;
+	// Each leg comes back as edges of the map's graph, so no StreetSegments are built
+	vector<vector<unsigned int>> legPaths(legCount);
+	vector<double> legDistances(legCount, 0);
+	vector<DeliveryResult> legResults(legCount, DELIVERY_SUCCESS);
+	pool.run((unsigned int)legCount, [&](unsigned int leg, unsigned int worker) {
+		legResults[leg] = m_routers[worker]->generatePointToPointPath(stops[leg], stops[leg + 1], legPaths[leg], legDistances[leg]);
+	});
+
+	// Add each leg's distance travelled in trip order
+	for (size_t leg = 0; leg < legCount; ++leg) {
 		// If not successful...
-		if (dr != DELIVERY_SUCCESS) {
-			return dr;
+		if (legResults[leg] != DELIVERY_SUCCESS) {
+			return legResults[leg];
 		}
-		routes.push_back(route);
-		total += routeDistance;
+		total += legDistances[leg];
 	}
 
-	// Add route from last delivery to depot
-	dr = router.generatePointToPointRoute(deliveriesCopy[deliveries.size()-1].location, depot, route, routeDistance);
-	if (dr != DELIVERY_SUCCESS) {
-		return dr;
-	}
-	routes.push_back(route);
-	total += routeDistance;
-
 	// Update total distance travelled
 	totalDistanceTravelled = total;
 
 
 	// At this point, the input depot and deliveries must have been valid
+	const StreetGraph* graph = m_sm->graph();
 	int delivery = 0;
 	commands.clear();
 
 	// For each route...
-	for (list<list<StreetSegment>>::iterator ti = routes.begin(); ti != routes.end(); ++ti) {
-		for (list<StreetSegment>::iterator ri = ti->begin(); ri != ti->end(); ++ri) {
+	for (size_t leg = 0; leg < legCount; ++leg) {
+		const vector<unsigned int>& path = legPaths[leg];
+		NodeId from = graph->findNode(stops[leg]);
+		size_t i = 0;
+		while (i < path.size()) {
 			// Get this road's cardinal direction and its name
-			double distanceRoad = 0;
-			double degrees = angleOfLine(*ri);
+			double degrees = positiveDegrees(edgeAngle(graph, from, path[i]));
 			string dir;
 			if (degrees < 22.5 || degrees >= 337.5) {
 				dir = "east";
@@ -127,50 +170,37 @@ DeliveryResult DeliveryPlannerImpl::generateDeliveryPlan(
 			else {
 				dir = "southeast";
 			}
-			string name = ri->name;
-
-			// Until we reach a new street or the destination...
-			for (;;) {
-				// Get the distance for this particular road segment
-				distanceRoad += distanceEarthMiles(ri->start, ri->end);
-				++ri;
-				// If the next segment is the end...
-				if (ri == ti->end()) {
-					// Proceed command is finalized and ready
-					DeliveryCommand proceed;
-					proceed.initAsProceedCommand(dir, name, distanceRoad);
-					commands.push_back(proceed);
-					--ri;
-					break;
+			// Streets are compared by name ID; the name itself is only needed for the commands
+			StreetGraph::NameId name = graph->edgeName(path[i]);
+
+			// Until we reach a new street or the destination, add up this street's edge lengths
+			double distanceRoad = 0;
+			NodeId lastFrom = from;
+			for (; i < path.size() && graph->edgeName(path[i]) == name; ++i) {
+				distanceRoad += graph->edgeLength(path[i]);
+				lastFrom = from;
+				from = graph->edgeTarget(path[i]);
+			}
+			// Proceed command is finalized and ready
+			DeliveryCommand proceed;
+			proceed.initAsProceedCommand(dir, graph->streetName(name), distanceRoad);
+			commands.push_back(proceed);
+
+			// If the next edge is a new street...
+			if (i < path.size()) {
+				// Get angle between streets
+				double angle = positiveDegrees(edgeAngle(graph, from, path[i]) - edgeAngle(graph, lastFrom, path[i - 1]));
+				// Turn left
+				if (angle >= 1 && angle < 180) {
+					DeliveryCommand turnLeft;
+					turnLeft.initAsTurnCommand("left", graph->streetName(graph->edgeName(path[i])));
+					commands.push_back(turnLeft);
 				}
-				// If the next segment is a new street...
-				if (ri->name != name) {
-
-					// Proceed command is finalized and ready
-					DeliveryCommand proceed;
-					proceed.initAsProceedCommand(dir, name, distanceRoad);
-					commands.push_back(proceed);
-
-					// Get name of new street for turn command
-					name = ri->name;
-					// Get angle between streets
-					StreetSegment secondStreet = *ri;
-					--ri;
-					StreetSegment firstStreet = *ri;
-					double angle = angleBetween2Lines(firstStreet, secondStreet);
-					// Turn left
-					if (angle >= 1 && angle < 180) {
-						DeliveryCommand turnLeft;
-						turnLeft.initAsTurnCommand("left", name);
-						commands.push_back(turnLeft);
-					}
-					// Turn right
-					else if (angle >= 180 && angle <= 359) {
-						DeliveryCommand turnRight;
-						turnRight.initAsTurnCommand("right", name);
-						commands.push_back(turnRight);
-					}
-					break;
+				// Turn right
+				else if (angle >= 180 && angle <= 359) {
+					DeliveryCommand turnRight;
+					turnRight.initAsTurnCommand("right", graph->streetName(graph->edgeName(path[i])));
+					commands.push_back(turnRight);
 				}
 			}
 		}
@@ -209,3 +239,8 @@ DeliveryResult DeliveryPlanner::generateDeliveryPlan(
 {
 	return m_impl->generateDeliveryPlan(depot, deliveries, commands, totalDistanceTravelled);
 }
+
+void DeliveryPlanner::setEngine(OptimizerEngine engine)
+{
+	m_impl->setEngine(engine);
+}
@@ -0,0 +1,169 @@
+// DistanceMatrix.cpp
+
+#include "provided.h"
+#include "DistanceMatrix.h"
+#include "StreetGraph.h"
+#include "IndexedMinHeap.h"
+#include "WorkerPool.h"
+#include <vector>
+#include <limits>
+using namespace std;
+
+// DistanceMatrix implementation
+// Runs one Dijkstra per distinct source location, each stopping as soon as every
+// distinct target location has been settled, with the sources spread over the
+// shared worker pool. Each worker keeps its own search state between sources.
+class DistanceMatrixImpl
+{
+public:
+	DistanceMatrixImpl(const StreetMap* sm);
+	~DistanceMatrixImpl();
+	// Fills the matrix for locations
+	DeliveryResult compute(const vector<GeoCoord>& locations);
+	int size() const { return m_size; }
+	double distance(int from, int to) const { return m_dist[(size_t)from * m_size + to]; }
+private:
+	typedef StreetGraph::NodeId NodeId;
+	typedef StreetGraph::EdgeId EdgeId;
+
+	const StreetMap* m_sm;
+	int m_size;
+	// Row-major: m_dist[from * m_size + to]
+	vector<double> m_dist;
+
+	// Dijkstra state owned by one worker; a node's dist is only valid if its search number is current
+	struct SearchState {
+		vector<double> dist;
+		vector<unsigned int> search;
+		IndexedMinHeap heap;
+		unsigned int current;
+		SearchState() : current(0) {}
+	};
+	vector<SearchState> m_states;
+
+	// Distances from source to every node in targets (infinity if unreachable)
+	void searchFrom(SearchState& state, const StreetGraph* graph, NodeId source,
+		const vector<NodeId>& targets, const vector<int>& targetSlot, vector<double>& result) const;
+};
+
+DistanceMatrixImpl::DistanceMatrixImpl(const StreetMap* sm) : m_sm(sm), m_size(0)
+{
+}
+
+DistanceMatrixImpl::~DistanceMatrixImpl()
+{
+}
+
+DeliveryResult DistanceMatrixImpl::compute(const vector<GeoCoord>& locations)
+{
+	const StreetGraph* graph = m_sm->graph();
+	m_size = (int)locations.size();
+	m_dist.assign((size_t)m_size * m_size, numeric_limits<double>::infinity());
+
+	// Look every location up once; repeated locations share a node and only get searched once
+	vector<NodeId> nodes(m_size);
+	vector<NodeId> targets;
+	vector<int> targetSlot(graph->nodeCount(), -1); // position of a node in targets, or -1
+	for (int i = 0; i < m_size; ++i) {
+		nodes[i] = graph->findNode(locations[i]);
+		if (nodes[i] == StreetGraph::NO_NODE) {
+			return BAD_COORD;
+		}
+		if (targetSlot[nodes[i]] == -1) {
+			targetSlot[nodes[i]] = (int)targets.size();
+			targets.push_back(nodes[i]);
+		}
+	}
+
+	// One search per distinct node, spread over the workers
+	WorkerPool& pool = WorkerPool::shared();
+	if (m_states.size() < pool.workerCount()) {
+		m_states.resize(pool.workerCount());
+	}
+	vector<vector<double>> rows(targets.size());
+	pool.run((unsigned int)targets.size(), [&](unsigned int task, unsigned int worker) {
+		searchFrom(m_states[worker], graph, targets[task], targets, targetSlot, rows[task]);
+	});
+
+	// Spread the distinct rows over the full matrix
+	bool allReachable = true;
+	for (int from = 0; from < m_size; ++from) {
+		const vector<double>& row = rows[targetSlot[nodes[from]]];
+		for (int to = 0; to < m_size; ++to) {
+			double d = row[targetSlot[nodes[to]]];
+			m_dist[(size_t)from * m_size + to] = d;
+			if (d == numeric_limits<double>::infinity()) {
+				allReachable = false;
+			}
+		}
+	}
+	return allReachable ? DELIVERY_SUCCESS : NO_ROUTE;
+}
+
+// Dijkstra from source, pruned once every target has been settled
+void DistanceMatrixImpl::searchFrom(SearchState& state, const StreetGraph* graph, NodeId source,
+	const vector<NodeId>& targets, const vector<int>& targetSlot, vector<double>& result) const
+{
+	// Fit the state to the graph and start a new search number
+	if (state.dist.size() != graph->nodeCount() || state.current == 0xFFFFFFFFu) {
+		state.dist.assign(graph->nodeCount(), 0);
+		state.search.assign(graph->nodeCount(), 0);
+		state.heap.resize(graph->nodeCount());
+		state.current = 0;
+	}
+	state.heap.clear();
+	++state.current;
+
+	result.assign(targets.size(), numeric_limits<double>::infinity());
+	size_t remaining = targets.size();
+	state.dist[source] = 0;
+	state.search[source] = state.current;
+	state.heap.pushOrDecrease(source, 0);
+	while (!state.heap.empty() && remaining > 0) {
+		NodeId u = state.heap.pop();
+		double du = state.dist[u];
+		// Settled distances are final, so record targets as they come off the heap
+		if (targetSlot[u] != -1) {
+			result[targetSlot[u]] = du;
+			--remaining;
+		}
+		for (StreetGraph::EdgeView edge : graph->edges(u)) {
+			NodeId v = edge.target;
+			double dv = du + edge.length;
+			if (state.search[v] != state.current || dv < state.dist[v]) {
+				state.search[v] = state.current;
+				state.dist[v] = dv;
+				state.heap.pushOrDecrease(v, dv);
+			}
+		}
+	}
+}
+
+//******************** DistanceMatrix functions *******************************
+
+// These functions simply delegate to DistanceMatrixImpl's functions.
+
+DistanceMatrix::DistanceMatrix(const StreetMap* sm)
+{
+	m_impl = new DistanceMatrixImpl(sm);
+}
+
+DistanceMatrix::~DistanceMatrix()
+{
+	delete m_impl;
+}
+
+DeliveryResult DistanceMatrix::compute(const vector<GeoCoord>& locations)
+{
+	return m_impl->compute(locations);
+}
+
+int DistanceMatrix::size() const
+{
+	return m_impl->size();
+}
+
+double DistanceMatrix::distance(int from, int to) const
+{
+	return m_impl->distance(from, to);
+}
@@ -0,0 +1,30 @@
+#ifndef DM_H_
+#define DM_H_
+
+// DistanceMatrix.h
+
+#include "provided.h"
+#include <vector>
+
+class DistanceMatrixImpl;
+
+// Shortest road distances in miles between every pair of a set of locations.
+// compute() returns BAD_COORD if a location isn't on the map, and NO_ROUTE if some
+// pair isn't connected (that pair's distance is then infinity); the other entries
+// are filled in either way. distance(i, j) is from locations[i] to locations[j].
+class DistanceMatrix
+{
+public:
+	DistanceMatrix(const StreetMap* sm);
+	~DistanceMatrix();
+	DeliveryResult compute(const std::vector<GeoCoord>& locations);
+	int size() const;
+	double distance(int from, int to) const;
+	// We prevent a DistanceMatrix object from being copied or assigned.
+	DistanceMatrix(const DistanceMatrix&) = delete;
+	DistanceMatrix& operator=(const DistanceMatrix&) = delete;
+private:
+	DistanceMatrixImpl* m_impl;
+};
+
+#endif
@@ -6,7 +6,13 @@
 // Dean Jones
 // 005-299-127
 
-template<typename KeyType, typename ValueType>
+#include "SlabAllocator.h"
+#include <new>
+#include <type_traits>
+
+// KVPair nodes come from NodeAllocator (see SlabAllocator.h): by default slabs that are
+// freed all at once, or HeapAllocator for one operator new per node.
+template<typename KeyType, typename ValueType, template<typename> class NodeAllocator = SlabAllocator>
 class ExpandableHashMap
 {
 public:
@@ -52,75 +58,61 @@ private:
 		KeyType key;
 		ValueType value;
 		KVPair* next;
+		unsigned int hash; // hasher(key), kept so rehashing doesn't need to hash again
 	};
 	KVPair** m_map;
-	// Helper function for adding a KV pair to a bigger map when the load would have been reached
-	void addNewKVPair(KVPair**& map, unsigned int buckets, KeyType key, ValueType value);
+	NodeAllocator<KVPair> m_nodes;
+	// Helper function for getting a new, empty bucket array
+	static KVPair** newBuckets(unsigned int buckets);
+	// Helper function for destroying every KVPair and giving its storage back
+	void deleteAll();
+	// Gives one destroyed KVPair's storage back, unless the allocator frees in bulk
+	void deallocate(KVPair* kv, std::false_type) { m_nodes.deallocate(kv); }
+	void deallocate(KVPair*, std::true_type) {}
 };
 
 // EHM has 8 buckets and no associations. Every pointer in m_map should initially be nullptr.
-template<typename KeyType, typename ValueType>
-ExpandableHashMap<KeyType, ValueType>::ExpandableHashMap(double maximumLoadFactor): m_buckets(8), m_assoc(0), m_load(maximumLoadFactor), m_map(new KVPair*[m_buckets])
+template<typename KeyType, typename ValueType, template<typename> class NodeAllocator>
+ExpandableHashMap<KeyType, ValueType, NodeAllocator>::ExpandableHashMap(double maximumLoadFactor): m_buckets(8), m_assoc(0), m_load(maximumLoadFactor), m_map(newBuckets(m_buckets))
 {
 	// If load wasn't positive, set it to default of 0.5
 	if (maximumLoadFactor <= 0) {
 		m_load = 0.5;
 	}
-	for (unsigned int i = 0; i < m_buckets; ++i) {
-		m_map[i] = nullptr;
-	}
 }
 
 // Delete every entry in m_map
-template<typename KeyType, typename ValueType>
-ExpandableHashMap<KeyType, ValueType>::~ExpandableHashMap()
+template<typename KeyType, typename ValueType, template<typename> class NodeAllocator>
+ExpandableHashMap<KeyType, ValueType, NodeAllocator>::~ExpandableHashMap()
 {
-	// For each bucket in the map...
-	for (unsigned int i = 0; i < m_buckets; ++i) {
-		KVPair* kv = m_map[i];
-		// While a pointer at the bucket isn't nullptr...
-		while (kv != nullptr)  {
-			// Delete the KVPair the pointer refers to
-			KVPair* nextkv = kv->next;
-			delete kv;
-			kv = nextkv;
-		}
-	}
+	deleteAll();
 	// Delete any dynamically allocated memory still left
 	delete[] m_map;
 }
 
 // Resets the EHM to 8 buckets and no associations
-template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::reset()
+template<typename KeyType, typename ValueType, template<typename> class NodeAllocator>
+void ExpandableHashMap<KeyType, ValueType, NodeAllocator>::reset()
 {
 	// Like the destructor, delete all the KVPairs in the map
-	for (unsigned int i = 0; i < m_buckets; ++i) {
-		KVPair* kv = m_map[i];
-		while (kv != nullptr) {
-			KVPair* nextkv = kv->next;
-			delete kv;
-			kv = nextkv;
-		}
-	}
+	deleteAll();
 	m_buckets = 8;
 	m_assoc = 0;
-	// Reset the buckets to nullptr
-	for (unsigned int i = 0; i < m_buckets; ++i) {
-		m_map[i] = nullptr;
-	}
+	// Start again with 8 empty buckets
+	delete[] m_map;
+	m_map = newBuckets(m_buckets);
 }
 
 // Returns number of associations made in map
-template<typename KeyType, typename ValueType>
-int ExpandableHashMap<KeyType, ValueType>::size() const
+template<typename KeyType, typename ValueType, template<typename> class NodeAllocator>
+int ExpandableHashMap<KeyType, ValueType, NodeAllocator>::size() const
 {
 	return m_assoc;
 }
 
 // Associates a given key with a given value
-template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
+template<typename KeyType, typename ValueType, template<typename> class NodeAllocator>
+void ExpandableHashMap<KeyType, ValueType, NodeAllocator>::associate(const KeyType& key, const ValueType& value)
 {
 	// Try to find the key first
 	ValueType* valuePtr = find(key);
@@ -137,20 +129,18 @@ void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const
 	if (m_assoc >= double(m_buckets) * m_load) {
 		// Double the number of buckets
 		m_buckets *= 2;
-		// Make a new map with the new number of buckets. Set all its entries to nullptr initially.
-		KVPair** newMap = new KVPair*[m_buckets];
-		for (unsigned int i = 0; i < m_buckets; ++i) {
-			newMap[i] = nullptr;
-		}
+		// Make a new map with the new number of buckets
+		KVPair** newMap = newBuckets(m_buckets);
 
 		// For all the buckets in the old map...
-		for (int i = 0; i < m_buckets / 2; ++i) {
-			// Get the KVPairs and add them to the new map. Also, delete them from the old one.
+		for (unsigned int i = 0; i < m_buckets / 2; ++i) {
+			// Move the KVPairs themselves over to their buckets in the new map
 			KVPair* kv = m_map[i];
 			while (kv != nullptr) {
 				KVPair* next = kv->next;
-				addNewKVPair(newMap, m_buckets, kv->key, kv->value);
-				delete kv;
+				unsigned int index = kv->hash % m_buckets;
+				kv->next = newMap[index];
+				newMap[index] = kv;
 				kv = next;
 			}
 		}
@@ -159,13 +149,16 @@ void ExpandableHashMap<KeyType, ValueType>::associate(const KeyType& key, const
 		m_map = newMap;
 	}
 
-	// Add the given key and value into the map
-	addNewKVPair(m_map, m_buckets, key, value);
+	// Add the given key and value at the front of its bucket, copying each of them once
+	unsigned int hasher(const KeyType& k); // prototype
+	unsigned int hash = hasher(key);
+	unsigned int index = hash % m_buckets;
+	m_map[index] = new (m_nodes.allocate()) KVPair{ key, value, m_map[index], hash };
 }
 
 // Returns ptr to value if key is in the map or nullptr otherwise
-template<typename KeyType, typename ValueType>
-const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key) const
+template<typename KeyType, typename ValueType, template<typename> class NodeAllocator>
+const ValueType* ExpandableHashMap<KeyType, ValueType, NodeAllocator>::find(const KeyType& key) const
 {
 	unsigned int hasher(const KeyType& k); // prototype
 	unsigned int index = hasher(key) % m_buckets; // the right index to look has to be from 0 to m_buckets - 1
@@ -185,16 +178,38 @@ const ValueType* ExpandableHashMap<KeyType, ValueType>::find(const KeyType& key)
 	return nullptr;
 }
 
-// Adds key and value into the map
-template<typename KeyType, typename ValueType>
-void ExpandableHashMap<KeyType, ValueType>::addNewKVPair(KVPair**& map, unsigned int buckets, KeyType key, ValueType value) {
-	// Again, use hasher to get the right index
-	unsigned int hasher(const KeyType & k); // prototype hash function
-	unsigned int index = hasher(key) % buckets;
-
-	// Insert the KVPair at the index by setting its next to the KVPair originally at the index
-	KVPair* oldFront = map[index];
-	KVPair* newFront = new KVPair{ key, value, oldFront };
-	map[index] = newFront;
+// Returns an array of buckets, all set to nullptr
+template<typename KeyType, typename ValueType, template<typename> class NodeAllocator>
+typename ExpandableHashMap<KeyType, ValueType, NodeAllocator>::KVPair** ExpandableHashMap<KeyType, ValueType, NodeAllocator>::newBuckets(unsigned int buckets)
+{
+	KVPair** map = new KVPair*[buckets];
+	for (unsigned int i = 0; i < buckets; ++i) {
+		map[i] = nullptr;
+	}
+	return map;
+}
+
+// Destroys every KVPair. An allocator that frees in bulk gets all its storage back in one go,
+// and if KVPairs don't need destroying either the buckets aren't even walked.
+template<typename KeyType, typename ValueType, template<typename> class NodeAllocator>
+void ExpandableHashMap<KeyType, ValueType, NodeAllocator>::deleteAll()
+{
+	const bool bulk = NodeAllocator<KVPair>::FREES_IN_BULK != 0;
+	if (!bulk || !std::is_trivially_destructible<KVPair>::value) {
+		// For each bucket in the map...
+		for (unsigned int i = 0; i < m_buckets; ++i) {
+			KVPair* kv = m_map[i];
+			// While a pointer at the bucket isn't nullptr...
+			while (kv != nullptr) {
+				// Destroy the KVPair the pointer refers to
+				KVPair* nextkv = kv->next;
+				kv->~KVPair();
+				deallocate(kv, std::integral_constant<bool, bulk>());
+				kv = nextkv;
+			}
+			m_map[i] = nullptr;
+		}
+	}
+	m_nodes.releaseAll();
 }
 #endif
\ No newline at end of file
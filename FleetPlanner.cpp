@@ -0,0 +1,101 @@
+// FleetPlanner.cpp
+
+#include "provided.h"
+#include "FleetPlanner.h"
+#include "WorkerPool.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <chrono>
+using namespace std;
+
+class FleetPlannerImpl
+{
+public:
+	FleetPlannerImpl(const StreetMap* sm);
+	~FleetPlannerImpl();
+	void planAll(const vector<DeliveryJob>& jobs, vector<DeliveryPlan>& plans) const;
+	FleetStats lastStats() const { return m_stats; }
+private:
+	const StreetMap* m_sm;
+	// One planner per pool worker; a planner's matrix and routers are reused by every job it plans
+	mutable vector<unique_ptr<DeliveryPlanner>> m_planners;
+	mutable FleetStats m_stats;
+};
+
+FleetPlannerImpl::FleetPlannerImpl(const StreetMap* sm) : m_sm(sm)
+{
+}
+
+FleetPlannerImpl::~FleetPlannerImpl()
+{
+}
+
+void FleetPlannerImpl::planAll(const vector<DeliveryJob>& jobs, vector<DeliveryPlan>& plans) const
+{
+	auto started = chrono::steady_clock::now();
+	plans.assign(jobs.size(), DeliveryPlan());
+
+	WorkerPool& pool = WorkerPool::shared();
+	while (m_planners.size() < pool.workerCount()) {
+		m_planners.push_back(unique_ptr<DeliveryPlanner>(new DeliveryPlanner(m_sm)));
+	}
+
+	// Workers take the next job as soon as they finish one, so hand out the biggest jobs first:
+	// a large job started last would leave everyone else waiting for it
+	vector<size_t> byDeliveries(jobs.size());
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		byDeliveries[i] = i;
+	}
+	stable_sort(byDeliveries.begin(), byDeliveries.end(), [&jobs](size_t a, size_t b) {
+		return jobs[a].deliveries.size() > jobs[b].deliveries.size();
+	});
+
+	pool.run((unsigned int)jobs.size(), [&](unsigned int task, unsigned int worker) {
+		size_t i = byDeliveries[task];
+		auto jobStarted = chrono::steady_clock::now();
+		plans[i].result = m_planners[worker]->generateDeliveryPlan(jobs[i].depot, jobs[i].deliveries,
+			plans[i].commands, plans[i].totalDistanceTravelled);
+		plans[i].milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - jobStarted).count();
+	});
+
+	m_stats = FleetStats();
+	m_stats.jobs = (int)jobs.size();
+	m_stats.threads = min(pool.workerCount(), (unsigned int)max((size_t)1, jobs.size()));
+	for (size_t i = 0; i < jobs.size(); ++i) {
+		m_stats.deliveries += (int)jobs[i].deliveries.size();
+		if (plans[i].result == DELIVERY_SUCCESS) {
+			++m_stats.succeeded;
+		}
+	}
+	m_stats.milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - started).count();
+	if (m_stats.milliseconds > 0) {
+		m_stats.jobsPerSecond = m_stats.jobs * 1000 / m_stats.milliseconds;
+		m_stats.deliveriesPerSecond = m_stats.deliveries * 1000 / m_stats.milliseconds;
+	}
+}
+
+
+//******************** FleetPlanner functions *********************************
+
+// These functions simply delegate to FleetPlannerImpl's functions.
+
+FleetPlanner::FleetPlanner(const StreetMap* sm)
+{
+	m_impl = new FleetPlannerImpl(sm);
+}
+
+FleetPlanner::~FleetPlanner()
+{
+	delete m_impl;
+}
+
+void FleetPlanner::planAll(const vector<DeliveryJob>& jobs, vector<DeliveryPlan>& plans) const
+{
+	m_impl->planAll(jobs, plans);
+}
+
+FleetStats FleetPlanner::lastStats() const
+{
+	return m_impl->lastStats();
+}
@@ -0,0 +1,68 @@
+#ifndef FP_H_
+#define FP_H_
+
+// FleetPlanner.h
+
+#include "provided.h"
+#include <vector>
+
+// One order for FleetPlanner: a depot and the deliveries to make from it
+struct DeliveryJob
+{
+	DeliveryJob(const GeoCoord& dep, const std::vector<DeliveryRequest>& dels)
+		: depot(dep), deliveries(dels)
+	{}
+	GeoCoord depot;
+	std::vector<DeliveryRequest> deliveries;
+};
+
+// What DeliveryPlanner gave for one job
+struct DeliveryPlan
+{
+	DeliveryPlan()
+		: result(DELIVERY_SUCCESS), totalDistanceTravelled(0), milliseconds(0)
+	{}
+	DeliveryResult result;
+	std::vector<DeliveryCommand> commands;
+	double totalDistanceTravelled;
+	double milliseconds; // time spent planning this job
+};
+
+// Throughput of FleetPlanner's last batch
+struct FleetStats
+{
+	FleetStats()
+		: jobs(0), succeeded(0), deliveries(0), threads(0), milliseconds(0), jobsPerSecond(0), deliveriesPerSecond(0)
+	{}
+	int jobs;
+	int succeeded; // jobs whose result is DELIVERY_SUCCESS
+	int deliveries; // over every job
+	unsigned int threads; // planning at once
+	double milliseconds; // for the whole batch
+	double jobsPerSecond;
+	double deliveriesPerSecond;
+};
+
+class FleetPlannerImpl;
+
+// Plans many jobs on one map at the same time on the shared pool's threads (each job's own
+// searches then run on the thread that took it). Jobs are claimed from one shared counter:
+// a thread that finishes a job takes the next unplanned one, so a long job doesn't hold up
+// the rest. There are no per-thread queues and no stealing between them. Every worker keeps
+// a DeliveryPlanner between batches. planAll must not be called from several threads at once.
+class FleetPlanner
+{
+public:
+	FleetPlanner(const StreetMap* sm);
+	~FleetPlanner();
+	// plans[i] is for jobs[i]
+	void planAll(const std::vector<DeliveryJob>& jobs, std::vector<DeliveryPlan>& plans) const;
+	FleetStats lastStats() const;
+	// We prevent a FleetPlanner object from being copied or assigned.
+	FleetPlanner(const FleetPlanner&) = delete;
+	FleetPlanner& operator=(const FleetPlanner&) = delete;
+private:
+	FleetPlannerImpl* m_impl;
+};
+
+#endif
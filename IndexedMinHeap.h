@@ -0,0 +1,147 @@
+#ifndef IMH_H_
+#define IMH_H_
+
+// IndexedMinHeap.h
+
+// Binary min-heap of node IDs keyed by double costs, with a position index so
+// that any node's key can be lowered in O(log n) (decrease-key) and membership
+// checked in O(1). Node IDs must be smaller than the capacity given to resize().
+// clear() only touches the nodes still in the heap, so one heap can be reused for
+// many searches over the same graph without paying O(V) each time.
+
+#include <vector>
+
+class IndexedMinHeap
+{
+public:
+	typedef unsigned int Id;
+
+	IndexedMinHeap(unsigned int capacity = 0) { resize(capacity); }
+
+	// Makes room for IDs 0 .. capacity - 1 and empties the heap
+	void resize(unsigned int capacity)
+	{
+		m_heap.clear();
+		m_pos.assign(capacity, NOT_IN_HEAP);
+		m_key.assign(capacity, 0);
+	}
+	unsigned int capacity() const { return (unsigned int)m_pos.size(); }
+
+	// Removes everything still in the heap
+	void clear()
+	{
+		for (size_t i = 0; i < m_heap.size(); ++i) {
+			m_pos[m_heap[i]] = NOT_IN_HEAP;
+		}
+		m_heap.clear();
+	}
+
+	bool empty() const { return m_heap.empty(); }
+	unsigned int size() const { return (unsigned int)m_heap.size(); }
+	bool contains(Id id) const { return m_pos[id] != NOT_IN_HEAP; }
+	// Key of an ID currently in the heap
+	double key(Id id) const { return m_key[id]; }
+	// ID and key of the minimum; the heap must not be empty
+	Id top() const { return m_heap[0]; }
+	double topKey() const { return m_key[m_heap[0]]; }
+
+	// Inserts id with key, or lowers its key if it's already in the heap with a bigger one.
+	// Returns false if id was already in the heap with a key no bigger than the given one.
+	bool pushOrDecrease(Id id, double key)
+	{
+		unsigned int pos = m_pos[id];
+		if (pos == NOT_IN_HEAP) {
+			pos = (unsigned int)m_heap.size();
+			m_heap.push_back(id);
+		}
+		else if (key >= m_key[id]) {
+			return false;
+		}
+		m_key[id] = key;
+		siftUp(pos, id);
+		return true;
+	}
+
+	// Removes and returns the ID with the smallest key
+	Id pop()
+	{
+		Id minId = m_heap[0];
+		m_pos[minId] = NOT_IN_HEAP;
+		Id last = m_heap.back();
+		m_heap.pop_back();
+		if (!m_heap.empty()) {
+			siftDown(0, last);
+		}
+		return minId;
+	}
+
+	// Removes id from the heap if it's there
+	void remove(Id id)
+	{
+		unsigned int pos = m_pos[id];
+		if (pos == NOT_IN_HEAP) {
+			return;
+		}
+		m_pos[id] = NOT_IN_HEAP;
+		Id last = m_heap.back();
+		m_heap.pop_back();
+		if (pos < m_heap.size()) {
+			// Refill the hole with the last element and move it whichever way it needs to go
+			if (pos > 0 && m_key[last] < m_key[m_heap[(pos - 1) / 2]]) {
+				siftUp(pos, last);
+			}
+			else {
+				siftDown(pos, last);
+			}
+		}
+	}
+
+private:
+	enum { NOT_IN_HEAP = 0xFFFFFFFFu };
+	std::vector<Id> m_heap; // heap-ordered IDs
+	std::vector<unsigned int> m_pos; // m_pos[id] is id's index in m_heap or NOT_IN_HEAP
+	std::vector<double> m_key; // m_key[id] is id's current key
+
+	// Places id at pos or above, moving bigger parents down into the hole
+	void siftUp(unsigned int pos, Id id)
+	{
+		double k = m_key[id];
+		while (pos > 0) {
+			unsigned int parent = (pos - 1) / 2;
+			if (!(k < m_key[m_heap[parent]])) {
+				break;
+			}
+			m_heap[pos] = m_heap[parent];
+			m_pos[m_heap[pos]] = pos;
+			pos = parent;
+		}
+		m_heap[pos] = id;
+		m_pos[id] = pos;
+	}
+
+	// Places id at pos or below, moving smaller children up into the hole
+	void siftDown(unsigned int pos, Id id)
+	{
+		double k = m_key[id];
+		unsigned int n = (unsigned int)m_heap.size();
+		for (;;) {
+			unsigned int child = 2 * pos + 1;
+			if (child >= n) {
+				break;
+			}
+			if (child + 1 < n && m_key[m_heap[child + 1]] < m_key[m_heap[child]]) {
+				++child;
+			}
+			if (!(m_key[m_heap[child]] < k)) {
+				break;
+			}
+			m_heap[pos] = m_heap[child];
+			m_pos[m_heap[pos]] = pos;
+			pos = child;
+		}
+		m_heap[pos] = id;
+		m_pos[id] = pos;
+	}
+};
+
+#endif
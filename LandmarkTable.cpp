@@ -0,0 +1,333 @@
+// LandmarkTable.cpp
+
+#include "LandmarkTable.h"
+#include "IndexedMinHeap.h"
+#include <vector>
+#include <string>
+#include <fstream>
+#include <random>
+#include <limits>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+using namespace std;
+
+const double LandmarkTable::UNREACHABLE = numeric_limits<double>::infinity();
+
+namespace
+{
+	// Landmark file layout: header, landmark node IDs (padded to 8 bytes), then the distance table
+	const char LANDMARK_MAGIC[8] = { 'G', 'O', 'O', 'B', 'L', 'M', 'K', '\0' };
+	const uint32_t LANDMARK_VERSION = 1;
+	const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+	struct LandmarkHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		uint32_t nodeCount;
+		uint32_t landmarkCount;
+		uint64_t graphChecksum;
+	};
+
+	// Dijkstra over the whole graph from source. Unreached nodes keep an infinite distance.
+	// If asked, also records each node's parent and the order nodes were settled in.
+	void shortestDistances(const StreetGraph* graph, StreetGraph::NodeId source, vector<double>& dist,
+		vector<StreetGraph::NodeId>* parent, vector<StreetGraph::NodeId>* order)
+	{
+		unsigned int n = graph->nodeCount();
+		dist.assign(n, numeric_limits<double>::infinity());
+		if (parent != nullptr) {
+			parent->assign(n, StreetGraph::NO_NODE);
+		}
+		if (order != nullptr) {
+			order->clear();
+		}
+		IndexedMinHeap heap(n);
+		dist[source] = 0;
+		heap.pushOrDecrease(source, 0);
+		while (!heap.empty()) {
+			StreetGraph::NodeId u = heap.pop();
+			if (order != nullptr) {
+				order->push_back(u);
+			}
+			for (StreetGraph::EdgeId e = graph->edgeBegin(u); e != graph->edgeEnd(u); ++e) {
+				StreetGraph::NodeId v = graph->edgeTarget(e);
+				double d = dist[u] + graph->edgeLength(e);
+				if (d < dist[v]) {
+					dist[v] = d;
+					if (parent != nullptr) {
+						(*parent)[v] = u;
+					}
+					heap.pushOrDecrease(v, d);
+				}
+			}
+		}
+	}
+
+	// Whether dist could be a landmark table for graph: no negative or NaN distances, every
+	// landmark 0 from itself, and no street shorter than the gap it spans in some landmark's
+	// distances, which is what keeps lower bounds from overestimating
+	bool tableValid(const StreetGraph* graph, const vector<uint32_t>& landmarks, const vector<double>& dist)
+	{
+		size_t k = landmarks.size();
+		for (size_t i = 0; i < k; ++i) {
+			if (dist[landmarks[i] * k + i] != 0) {
+				return false;
+			}
+		}
+		for (size_t j = 0; j < dist.size(); ++j) {
+			if (!(dist[j] >= 0)) {
+				return false;
+			}
+		}
+		for (StreetGraph::NodeId u = 0; u < graph->nodeCount(); ++u) {
+			for (StreetGraph::EdgeId e = graph->edgeBegin(u); e != graph->edgeEnd(u); ++e) {
+				const double* du = &dist[u * k];
+				const double* dv = &dist[graph->edgeTarget(e) * k];
+				for (size_t i = 0; i < k; ++i) {
+					if (dv[i] > du[i] + graph->edgeLength(e)) {
+						return false;
+					}
+				}
+			}
+		}
+		return true;
+	}
+}
+
+LandmarkTable::LandmarkTable() : m_graphChecksum(0)
+{
+}
+
+void LandmarkTable::clear()
+{
+	vector<NodeId>().swap(m_landmarks);
+	vector<double>().swap(m_dist);
+	m_graphChecksum = 0;
+}
+
+// Picks the landmarks one at a time, keeping each one's distance column, then interleaves the columns
+void LandmarkTable::build(const StreetGraph* graph, unsigned int count, LandmarkStrategy strategy)
+{
+	clear();
+	unsigned int n = graph->nodeCount();
+	if (n == 0 || count == 0) {
+		return;
+	}
+
+	// The first landmark is the node farthest from node 0, which lands it on the edge of the map
+	vector<double> dist;
+	shortestDistances(graph, 0, dist, nullptr, nullptr);
+	NodeId next = farthestLandmark(graph, dist);
+
+	// nearest[v] is v's distance to the closest landmark so far
+	vector<vector<double>> columns;
+	vector<double> nearest(n, UNREACHABLE);
+	mt19937 rng(n); // fixed seed, so the same map always gets the same landmarks
+	while (next != StreetGraph::NO_NODE && columns.size() < count) {
+		m_landmarks.push_back(next);
+		shortestDistances(graph, next, dist, nullptr, nullptr);
+		for (unsigned int v = 0; v < n; ++v) {
+			if (dist[v] < nearest[v]) {
+				nearest[v] = dist[v];
+			}
+		}
+		columns.push_back(dist);
+
+		if (strategy == LANDMARKS_FARTHEST) {
+			next = farthestLandmark(graph, nearest);
+		}
+		else {
+			// Root the avoid tree somewhere connected to the landmarks picked so far
+			NodeId root = rng() % n;
+			for (int tries = 0; tries < 100 && nearest[root] == UNREACHABLE; ++tries) {
+				root = rng() % n;
+			}
+			next = avoidLandmark(graph, root, columns);
+		}
+		// Stop rather than pick the same landmark twice
+		for (size_t i = 0; i < m_landmarks.size(); ++i) {
+			if (m_landmarks[i] == next) {
+				next = StreetGraph::NO_NODE;
+			}
+		}
+	}
+
+	// Store each node's landmark distances next to each other, since a bound reads all of them
+	unsigned int k = (unsigned int)columns.size();
+	m_dist.resize((size_t)n * k);
+	for (unsigned int v = 0; v < n; ++v) {
+		for (unsigned int i = 0; i < k; ++i) {
+			m_dist[(size_t)v * k + i] = columns[i][v];
+		}
+	}
+	m_graphChecksum = graph->checksum();
+}
+
+// Farthest strategy: the reachable node with the biggest distance to its nearest landmark
+LandmarkTable::NodeId LandmarkTable::farthestLandmark(const StreetGraph* graph, const vector<double>& nearest) const
+{
+	NodeId best = StreetGraph::NO_NODE;
+	for (unsigned int v = 0; v < graph->nodeCount(); ++v) {
+		if (nearest[v] != UNREACHABLE && nearest[v] > 0 && (best == StreetGraph::NO_NODE || nearest[v] > nearest[best])) {
+			best = v;
+		}
+	}
+	return best;
+}
+
+// Avoid strategy (Goldberg & Werneck): in the shortest path tree from root, weigh each node by how
+// badly the current landmarks bound its distance from root, add the weights up each subtree that
+// has no landmark in it, then walk down the heaviest subtrees to a leaf and make that a landmark
+LandmarkTable::NodeId LandmarkTable::avoidLandmark(const StreetGraph* graph, NodeId root, const vector<vector<double>>& columns) const
+{
+	unsigned int n = graph->nodeCount();
+	vector<double> dist;
+	vector<NodeId> parent, order;
+	shortestDistances(graph, root, dist, &parent, &order);
+
+	vector<double> size(n, 0);
+	vector<bool> covered(n, false);
+	for (size_t i = 0; i < m_landmarks.size(); ++i) {
+		covered[m_landmarks[i]] = true;
+	}
+	// Children are settled after their parents, so the reverse settle order visits subtrees bottom up
+	for (size_t i = order.size(); i > 0; --i) {
+		NodeId v = order[i - 1];
+		double bound = 0;
+		for (size_t c = 0; c < columns.size(); ++c) {
+			if (columns[c][v] != UNREACHABLE && columns[c][root] != UNREACHABLE) {
+				bound = max(bound, fabs(columns[c][v] - columns[c][root]));
+			}
+		}
+		size[v] += dist[v] - bound;
+		if (covered[v]) {
+			size[v] = 0;
+		}
+		NodeId p = parent[v];
+		if (p != StreetGraph::NO_NODE) {
+			if (covered[v]) {
+				covered[p] = true;
+			}
+			else {
+				size[p] += size[v];
+			}
+		}
+	}
+	if (covered[root]) {
+		size[root] = 0;
+	}
+
+	// Children lists of the tree, in CSR form
+	vector<unsigned int> childOffsets(n + 1, 0);
+	for (size_t i = 0; i < order.size(); ++i) {
+		if (parent[order[i]] != StreetGraph::NO_NODE) {
+			++childOffsets[parent[order[i]] + 1];
+		}
+	}
+	for (unsigned int v = 0; v < n; ++v) {
+		childOffsets[v + 1] += childOffsets[v];
+	}
+	vector<NodeId> children(childOffsets[n]);
+	vector<unsigned int> fill(childOffsets.begin(), childOffsets.end() - 1);
+	for (size_t i = 0; i < order.size(); ++i) {
+		NodeId p = parent[order[i]];
+		if (p != StreetGraph::NO_NODE) {
+			children[fill[p]++] = order[i];
+		}
+	}
+
+	// Walk down through the heaviest child until there's nowhere left to go
+	NodeId v = root;
+	for (;;) {
+		NodeId heaviest = StreetGraph::NO_NODE;
+		for (unsigned int c = childOffsets[v]; c != childOffsets[v + 1]; ++c) {
+			NodeId child = children[c];
+			if (size[child] > 0 && (heaviest == StreetGraph::NO_NODE || size[child] > size[heaviest])) {
+				heaviest = child;
+			}
+		}
+		if (heaviest == StreetGraph::NO_NODE) {
+			break;
+		}
+		v = heaviest;
+	}
+	return v;
+}
+
+// Writes the header, the landmark IDs and the distance table
+bool LandmarkTable::save(const string& file) const
+{
+	ofstream outfile(file, ios::binary | ios::trunc);
+	if (!outfile) {
+		cerr << "Error: Cannot create " << file << "!" << endl;
+		return false;
+	}
+	LandmarkHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, LANDMARK_MAGIC, sizeof(LANDMARK_MAGIC));
+	header.version = LANDMARK_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.nodeCount = m_landmarks.empty() ? 0 : (uint32_t)(m_dist.size() / m_landmarks.size());
+	header.landmarkCount = (uint32_t)m_landmarks.size();
+	header.graphChecksum = m_graphChecksum;
+	outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	vector<uint32_t> ids(m_landmarks.begin(), m_landmarks.end());
+	if (ids.size() % 2 != 0) {
+		ids.push_back(0);
+	}
+	outfile.write(reinterpret_cast<const char*>(ids.data()), ids.size() * sizeof(uint32_t));
+	outfile.write(reinterpret_cast<const char*>(m_dist.data()), m_dist.size() * sizeof(double));
+	if (!outfile) {
+		cerr << "Error: Cannot write " << file << "!" << endl;
+		return false;
+	}
+	return true;
+}
+
+// Reads a table written by save, checking that it belongs to graph
+bool LandmarkTable::load(const string& file, const StreetGraph* graph)
+{
+	clear();
+	ifstream infile(file, ios::binary);
+	if (!infile) {
+		cerr << "Error: Cannot open " << file << "!" << endl;
+		return false;
+	}
+	LandmarkHeader header;
+	infile.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!infile || memcmp(header.magic, LANDMARK_MAGIC, sizeof(LANDMARK_MAGIC)) != 0 || header.version != LANDMARK_VERSION
+		|| header.byteOrder != BYTE_ORDER_MARK || header.nodeCount != graph->nodeCount()
+		|| header.graphChecksum != graph->checksum() || header.landmarkCount == 0 || header.landmarkCount > header.nodeCount) {
+		cerr << "Error: " << file << " is not a landmark table for this map!" << endl;
+		return false;
+	}
+
+	vector<uint32_t> ids(header.landmarkCount + header.landmarkCount % 2);
+	infile.read(reinterpret_cast<char*>(ids.data()), ids.size() * sizeof(uint32_t));
+	m_dist.resize((size_t)header.nodeCount * header.landmarkCount);
+	infile.read(reinterpret_cast<char*>(m_dist.data()), m_dist.size() * sizeof(double));
+	if (!infile) {
+		cerr << "Error: " << file << " is truncated!" << endl;
+		clear();
+		return false;
+	}
+	ids.resize(header.landmarkCount);
+	for (size_t i = 0; i < ids.size(); ++i) {
+		if (ids[i] >= header.nodeCount) {
+			cerr << "Error: " << file << " names a landmark that isn't on this map!" << endl;
+			clear();
+			return false;
+		}
+	}
+	if (!tableValid(graph, ids, m_dist)) {
+		cerr << "Error: " << file << " has distances that don't fit this map!" << endl;
+		clear();
+		return false;
+	}
+	m_landmarks.assign(ids.begin(), ids.end());
+	m_graphChecksum = header.graphChecksum;
+	return true;
+}
@@ -0,0 +1,81 @@
+#ifndef LT_H_
+#define LT_H_
+
+// LandmarkTable.h
+
+// Landmark distances for ALT (A*, landmarks, triangle inequality) searches.
+// A handful of landmark nodes are picked and the road distance from each of them
+// to every node is stored. Because every street can be travelled both ways with
+// the same length, the triangle inequality gives |d(L, t) - d(L, u)| <= d(u, t)
+// for any landmark L, which is usually a much tighter lower bound on the remaining
+// distance than the crow-flies one when streets don't run straight to the goal.
+// Tables are tied to the exact graph they were built from and can be saved next to
+// the map and loaded again instead of being rebuilt.
+
+#include "provided.h"
+#include "StreetGraph.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// How StreetMap::buildLandmarks picks landmarks
+enum LandmarkStrategy : int
+{
+	LANDMARKS_FARTHEST, // each landmark as far as possible from the ones already picked
+	LANDMARKS_AVOID // each landmark behind the region the current ones bound worst
+};
+
+class LandmarkTable
+{
+public:
+	typedef StreetGraph::NodeId NodeId;
+
+	LandmarkTable();
+	// Picks count landmarks with the given strategy and computes their distance tables
+	void build(const StreetGraph* graph, unsigned int count, LandmarkStrategy strategy);
+	void clear();
+	bool empty() const { return m_landmarks.empty(); }
+	unsigned int landmarkCount() const { return (unsigned int)m_landmarks.size(); }
+	NodeId landmark(unsigned int i) const { return m_landmarks[i]; }
+
+	// Lower bound in miles on the road distance between u and t
+	double lowerBound(NodeId u, NodeId t) const
+	{
+		unsigned int k = (unsigned int)m_landmarks.size();
+		const double* du = &m_dist[(size_t)u * k];
+		const double* dt = &m_dist[(size_t)t * k];
+		double best = 0;
+		for (unsigned int i = 0; i < k; ++i) {
+			// Landmarks in another part of the map say nothing about u and t
+			if (du[i] != UNREACHABLE && dt[i] != UNREACHABLE) {
+				double bound = du[i] > dt[i] ? du[i] - dt[i] : dt[i] - du[i];
+				if (bound > best) {
+					best = bound;
+				}
+			}
+		}
+		return best;
+	}
+
+	// Files are only accepted for a graph with the same checksum as the one the table was built from
+	bool save(const std::string& file) const;
+	bool load(const std::string& file, const StreetGraph* graph); // on failure the table is left empty
+
+	// We prevent a LandmarkTable object from being copied or assigned.
+	LandmarkTable(const LandmarkTable&) = delete;
+	LandmarkTable& operator=(const LandmarkTable&) = delete;
+
+private:
+	static const double UNREACHABLE;
+
+	std::vector<NodeId> m_landmarks;
+	// m_dist[u * landmarkCount() + i] is the distance from landmark i to node u
+	std::vector<double> m_dist;
+	uint64_t m_graphChecksum;
+
+	// Picks the next landmark
+	NodeId farthestLandmark(const StreetGraph* graph, const std::vector<double>& nearest) const;
+	NodeId avoidLandmark(const StreetGraph* graph, NodeId root, const std::vector<std::vector<double>>& columns) const;
+};
+
+#endif
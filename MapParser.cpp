@@ -0,0 +1,217 @@
+// MapParser.cpp
+
+#include "MapParser.h"
+#include "WorkerPool.h"
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+using namespace std;
+
+namespace
+{
+	bool isBlank(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+	}
+
+	// The '\n' ending the line that starts at p, or end
+	const char* lineEnd(const char* p, const char* end)
+	{
+		const char* eol = static_cast<const char*>(memchr(p, '\n', end - p));
+		return eol == nullptr ? end : eol;
+	}
+
+	// Start of the line after the one ending at eol
+	const char* nextLine(const char* eol, const char* end)
+	{
+		return eol == end ? end : eol + 1;
+	}
+
+	// The line [p, eol) without a Windows line ending
+	MapParser::Text lineText(const char* p, const char* eol)
+	{
+		if (eol > p && eol[-1] == '\r') {
+			--eol;
+		}
+		MapParser::Text text = { p, (size_t)(eol - p) };
+		return text;
+	}
+
+	// Anything parseDecimal's fast path can't take, through strtod like std::stod does
+	bool parseSlowly(const char* begin, const char* end, double& value)
+	{
+		char buffer[64];
+		size_t length = end - begin;
+		if (length == 0 || length >= sizeof(buffer)) {
+			return false;
+		}
+		memcpy(buffer, begin, length);
+		buffer[length] = '\0';
+		char* stop;
+		value = strtod(buffer, &stop);
+		return stop != buffer;
+	}
+}
+
+MapParser::MapParser() : m_chunks(0)
+{
+}
+
+// Both powers of ten up to 1e22 and integers up to 2^53 are exact doubles, so dividing
+// one by the other gives the correctly rounded result, the same one strtod gives
+bool MapParser::parseDecimal(const char* begin, const char* end, double& value)
+{
+	static const double POWERS_OF_TEN[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	const int MAX_DIGITS = 15;
+	const int MAX_DECIMALS = 22;
+
+	const char* p = begin;
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+')) {
+		negative = *p == '-';
+		++p;
+	}
+	uint64_t mantissa = 0;
+	int digits = 0; // significant ones
+	int decimals = 0;
+	bool anyDigits = false, point = false;
+	for (; p < end; ++p) {
+		char c = *p;
+		if (c >= '0' && c <= '9') {
+			anyDigits = true;
+			if (mantissa != 0 || c != '0') {
+				++digits;
+			}
+			mantissa = mantissa * 10 + (c - '0');
+			decimals += point;
+			if (digits > MAX_DIGITS) {
+				return parseSlowly(begin, end, value);
+			}
+		}
+		else if (c == '.' && !point) {
+			point = true;
+		}
+		else {
+			// An exponent, "inf" or trailing junk
+			return parseSlowly(begin, end, value);
+		}
+	}
+	if (!anyDigits || decimals > MAX_DECIMALS) {
+		return parseSlowly(begin, end, value);
+	}
+	value = (double)mantissa / POWERS_OF_TEN[decimals];
+	if (negative) {
+		value = -value;
+	}
+	return true;
+}
+
+// Reads the stanzas the way StreetMap::load used to read them with getline and >>
+void MapParser::parse(const char* data, size_t bytes)
+{
+	m_streets.clear();
+	m_segments.clear();
+	m_stanzas.clear();
+	m_chunks = 0;
+
+	// Pass 1: find every stanza and the slots of its segments
+	const char* p = data;
+	const char* end = data + bytes;
+	unsigned int total = 0;
+	while (p < end) {
+		// The name only counts once its count has been read, so every street has a stanza
+		const char* eol = lineEnd(p, end);
+		Text name = lineText(p, eol);
+		p = nextLine(eol, end);
+
+		// The count, after any whitespace, newlines included; no count ends the map
+		while (p < end && (isBlank(*p) || *p == '\n')) {
+			++p;
+		}
+		bool negative = p < end && *p == '-';
+		if (p < end && (*p == '-' || *p == '+')) {
+			++p;
+		}
+		if (p == end || *p < '0' || *p > '9') {
+			break;
+		}
+		unsigned long long count = 0;
+		for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+			count = count < 0xFFFFFFFFull ? count * 10 + (*p - '0') : count;
+		}
+		p = nextLine(lineEnd(p, end), end);
+		m_streets.push_back(name);
+
+		Stanza stanza;
+		stanza.body = p;
+		stanza.first = total;
+		stanza.count = 0;
+		for (unsigned long long i = 0; !negative && i < count && p < end; ++i) {
+			p = nextLine(lineEnd(p, end), end);
+			++stanza.count;
+		}
+		stanza.end = p;
+		total += stanza.count;
+		m_stanzas.push_back(stanza);
+	}
+
+	// Pass 2: chunks of whole stanzas, parsed side by side
+	vector<size_t> bounds(1, 0);
+	size_t chunkBytes = 0;
+	for (size_t i = 0; i < m_stanzas.size(); ++i) {
+		chunkBytes += m_stanzas[i].end - m_stanzas[i].body;
+		if (chunkBytes >= CHUNK_BYTES || i + 1 == m_stanzas.size()) {
+			bounds.push_back(i + 1);
+			chunkBytes = 0;
+		}
+	}
+	m_segments.resize(total);
+	m_chunks = (unsigned int)bounds.size() - 1;
+	WorkerPool::shared().run(m_chunks, [&](unsigned int chunk, unsigned int) {
+		parseStanzas(bounds[chunk], bounds[chunk + 1]);
+	});
+}
+
+void MapParser::parseStanzas(size_t first, size_t last)
+{
+	for (size_t s = first; s < last; ++s) {
+		const Stanza& stanza = m_stanzas[s];
+		const char* p = stanza.body;
+		for (unsigned int i = 0; i < stanza.count; ++i) {
+			const char* eol = lineEnd(p, stanza.end);
+			Segment& segment = m_segments[stanza.first + i];
+			segment.street = (unsigned int)s;
+			parseLine(p, eol, segment);
+			p = nextLine(eol, stanza.end);
+		}
+	}
+}
+
+// The first four whitespace-separated words, each of which has to be a number; anything after them is ignored
+void MapParser::parseLine(const char* begin, const char* end, Segment& segment)
+{
+	segment.line = lineText(begin, end);
+	Text* texts[4] = { &segment.start.latitudeText, &segment.start.longitudeText, &segment.end.latitudeText, &segment.end.longitudeText };
+	double* values[4] = { &segment.start.latitude, &segment.start.longitude, &segment.end.latitude, &segment.end.longitude };
+	const char* p = begin;
+	segment.valid = false;
+	for (int w = 0; w < 4; ++w) {
+		while (p < end && isBlank(*p)) {
+			++p;
+		}
+		const char* word = p;
+		while (p < end && !isBlank(*p)) {
+			++p;
+		}
+		if (p == word || !parseDecimal(word, p, *values[w])) {
+			return;
+		}
+		texts[w]->data = word;
+		texts[w]->size = p - word;
+	}
+	segment.valid = true;
+}
@@ -0,0 +1,89 @@
+#ifndef MP_H_
+#define MP_H_
+
+// MapParser.h
+
+// Parses the text of a map file in place, for StreetMap::load. The text is a series of
+// stanzas: a street name line, a line with the number of segments, then that many lines
+// of "lat1 lon1 lat2 lon2". Parsing takes two passes:
+//  1. One thread walks the lines to find where each stanza starts and ends. This only
+//     looks for line ends, so it runs at memchr speed.
+//  2. The stanzas are split into chunks of about CHUNK_BYTES, and the chunks are parsed
+//     on the shared WorkerPool. Each segment's slot is known from the counts, so every
+//     chunk writes straight into the final array and nothing has to be merged.
+// Numbers are read by parseDecimal below, which allocates nothing. Names and coordinate
+// texts are left pointing into the parsed text, so it has to outlive the parser's results.
+
+#include <vector>
+#include <cstddef>
+
+// What the last StreetMap::load read and how fast
+struct MapLoadStats
+{
+	MapLoadStats()
+		: bytes(0), streets(0), segments(0), chunks(0), parseMilliseconds(0), milliseconds(0), megabytesPerSecond(0)
+	{}
+	size_t bytes; // of map text
+	int streets;
+	int segments; // well-formed ones
+	unsigned int chunks; // parsed in parallel
+	double parseMilliseconds; // reading and parsing the text
+	double milliseconds; // everything, building the graph and its index included
+	double megabytesPerSecond; // bytes over milliseconds
+};
+
+class MapParser
+{
+public:
+	// A stretch of the parsed text
+	struct Text {
+		const char* data;
+		size_t size;
+	};
+	struct Coord {
+		Text latitudeText;
+		Text longitudeText;
+		double latitude;
+		double longitude;
+	};
+	struct Segment {
+		unsigned int street; // index into streets()
+		bool valid; // false if the line didn't hold four coordinates
+		Text line; // the whole line, for reporting bad ones
+		Coord start;
+		Coord end;
+	};
+
+	MapParser();
+	// Parses bytes characters of data, replacing any earlier results
+	void parse(const char* data, size_t bytes);
+	const std::vector<Text>& streets() const { return m_streets; } // names, in file order
+	const std::vector<Segment>& segments() const { return m_segments; } // in file order
+	unsigned int chunks() const { return m_chunks; } // parsed in parallel by the last parse
+
+	// Reads the number in [begin, end) the way std::stod would, but without allocating;
+	// false if the text doesn't start with one. Numbers of up to 15 significant digits,
+	// like every coordinate in a map file, are converted exactly with one division;
+	// anything longer is handed to strtod.
+	static bool parseDecimal(const char* begin, const char* end, double& value);
+
+private:
+	enum { CHUNK_BYTES = 32768 };
+	struct Stanza {
+		const char* body; // first segment line
+		const char* end; // just past the last one
+		unsigned int count; // segment lines
+		unsigned int first; // slot of the first segment in m_segments
+	};
+	std::vector<Text> m_streets;
+	std::vector<Segment> m_segments;
+	std::vector<Stanza> m_stanzas; // m_stanzas[i] belongs to m_streets[i]
+	unsigned int m_chunks;
+
+	// Parses the stanzas [first, last)
+	void parseStanzas(size_t first, size_t last);
+	// Parses one segment line into segment
+	static void parseLine(const char* begin, const char* end, Segment& segment);
+};
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef MF_H_
+#define MF_H_
+
+// MappedFile.h
+
+// Read-only memory mapping of a whole file. The mapping lives until close() is
+// called or the object is destroyed, so anything pointing into data() must not
+// outlive it.
+
+#include <string>
+#include <cstddef>
+
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile(); // unmaps the file
+	bool open(const std::string& path); // maps path, returning false if it can't be opened or mapped
+	void close(); // unmaps the file, if any
+	bool isOpen() const { return m_data != nullptr; }
+	const char* data() const { return m_data; }
+	size_t size() const { return m_size; }
+
+	// We prevent a MappedFile object from being copied or assigned.
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+private:
+	const char* m_data;
+	size_t m_size;
+#ifdef _WIN32
+	void* m_file; // HANDLE of the open file
+	void* m_mapping; // HANDLE of the file mapping object
+#endif
+};
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef OE_H_
+#define OE_H_
+
+// OptimizerEngine.h
+
+// Search used by DeliveryOptimizer (see DeliveryOptimizer::setEngine)
+enum OptimizerEngine : int
+{
+	OPTIMIZER_ANNEALING, // random stretch reversals under a cooling schedule; about N^2.5 moves tried
+	OPTIMIZER_LOCAL_SEARCH, // nearest-neighbor start, then 2-opt, Or-opt and or-3opt moves until none helps
+	OPTIMIZER_PARALLEL_TEMPERING, // annealing chains at several temperatures on the worker pool, trading trips
+	OPTIMIZER_CLUSTERED // local search in compact sectors at once, then joined up; for thousands of stops
+};
+
+// What DeliveryOptimizer's last call did, for weighing engines against each other
+struct OptimizerReport
+{
+	OptimizerReport()
+		: engine(OPTIMIZER_ANNEALING), exact(false), stoppedEarly(false), stops(0), oldDistance(0), newDistance(0),
+		milliseconds(0), iterations(0), moves(0)
+	{}
+	OptimizerEngine engine;
+	bool exact; // solved exactly instead of by the engine (see DeliveryOptimizer::setExactLimit)
+	bool stoppedEarly; // cut short by the deadline, the iteration limit or the cancel flag
+	int stops; // deliveries ordered
+	double oldDistance;
+	double newDistance; // in a progress report, the best found so far
+	double milliseconds; // time spent optimizing
+	long long iterations; // moves tried
+	long long moves; // changes made to the order; 0 for an exact solve
+};
+
+#endif
@@ -4,38 +4,106 @@
 #include "provided.h"
 #include <list>
 #include <iostream>
-#include "ExpandableHashMap.h"
+#include <vector>
+#include "StreetGraph.h"
+#include "IndexedMinHeap.h"
+#include "ContractionHierarchy.h"
+#include "LandmarkTable.h"
+#include "RouteCache.h"
+#include "RouterMode.h"
+#include <algorithm>
 using namespace std;
 
 // PointToPointRouter implementation
+// A router keeps its search state between calls to avoid reallocating it, so a
+// single PointToPointRouter must not be used from several threads at once.
 class PointToPointRouterImpl
 {
 public:
 	// Constructs object with const pointer to StreetMap
 	PointToPointRouterImpl(const StreetMap* sm);
 	~PointToPointRouterImpl();
-	// Generates route found by A* algorithm between start and end
+	// Generates shortest route between start and end with the search chosen by setMode
 	DeliveryResult generatePointToPointRoute(
 		const GeoCoord& start,
 		const GeoCoord& end,
 		list<StreetSegment>& route,
 		double& totalDistanceTravelled) const;
+	DeliveryResult generatePointToPointPath(
+		const GeoCoord& start,
+		const GeoCoord& end,
+		vector<unsigned int>& edges,
+		double& totalDistanceTravelled) const;
+	void setMode(RouterMode mode) { m_mode = mode; }
+	RouterMode mode() const { return m_mode; }
+	void setCache(RouteCache* cache) { m_cache = cache; }
+	RouteCache* cache() const { return m_cache; }
 private:
+	typedef StreetGraph::NodeId NodeId;
+	typedef StreetGraph::EdgeId EdgeId;
+
 	// Takes pointer passed to constructor
 	const StreetMap* m_sm;
-	// Private struct for A* algorithm use
+	RouterMode m_mode;
+	// Routes are looked up here before searching and stored after, if it isn't nullptr
+	RouteCache* m_cache;
+
+	// Per-node A* bookkeeping. A node's entry is only meaningful if its search
+	// number matches m_search; anything else counts as "not reached yet".
 	struct PointNode {
-		GeoCoord gc;
-		double f_cost;
-		double g_cost;
-		double h_cost;
-		PointNode* parent;
-		string name;
-	};	
+		double g_cost; // best known distance from the start
+		NodeId parent; // previous node on that best path
+		EdgeId parentEdge; // edge taken from parent to reach this node
+		unsigned int search; // search that last touched this node
+		bool closed; // true once the node has been expanded
+	};
+	mutable vector<PointNode> m_nodes;
+	// Open set: nodes reached but not expanded, keyed by f cost
+	mutable IndexedMinHeap m_open;
+	mutable unsigned int m_search;
+	// The same for the backward half of ROUTER_BIDIRECTIONAL, where g cost is the distance to the
+	// end and parent is the next node towards the end, reached over parentEdge (parent -> node)
+	mutable vector<PointNode> m_reverseNodes;
+	mutable IndexedMinHeap m_reverseOpen;
+
+	// Query state for ROUTER_CONTRACTION_HIERARCHY
+	mutable ContractionHierarchy::Query m_chQuery;
+	mutable vector<ContractionHierarchy::PathEdge> m_chPath;
+
+	// Edges of the route found by the last search, in order from the start
+	mutable vector<EdgeId> m_path;
+
+	// The searches themselves; start and end are valid and different. On success the
+	// route is left in m_path and its length in totalDistanceTravelled.
+	DeliveryResult searchAStar(const StreetGraph* graph, NodeId startId, NodeId endId,
+		double& totalDistanceTravelled) const;
+	DeliveryResult searchBidirectional(const StreetGraph* graph, NodeId startId, NodeId endId,
+		double& totalDistanceTravelled) const;
+	DeliveryResult searchHierarchy(const StreetGraph* graph, const ContractionHierarchy* ch, NodeId startId, NodeId endId,
+		double& totalDistanceTravelled) const;
+	// Leaves the route from start to end in m_path, from the cache or a search, and startId at its start
+	DeliveryResult findPath(const GeoCoord& start, const GeoCoord& end, NodeId& startId, double& totalDistanceTravelled) const;
+	// Runs the search chosen by m_mode
+	DeliveryResult search(const StreetGraph* graph, NodeId startId, NodeId endId,
+		double& totalDistanceTravelled) const;
+	// Lower bound on the distance from u to goal: the straight line, or the landmark bound when it's tighter
+	static double heuristic(const StreetGraph* graph, const LandmarkTable* landmarks, NodeId u, NodeId goal)
+	{
+		double h = graph->crowBound(u, goal);
+		return landmarks == nullptr ? h : max(h, landmarks->lowerBound(u, goal));
+	}
+	// Makes the per-node state fit the graph and starts a new search number
+	void beginSearch(const StreetGraph* graph) const;
+	// Puts the edges leading to goal in m_path by following parent links back to the start
+	void buildPath(NodeId goal) const;
+	// Turns the edges in m_path into street segments
+	void buildRoute(const StreetGraph* graph, NodeId startId, list<StreetSegment>& route) const;
+	// The edge from -> to matching the street and length of edge reverse (to -> from)
+	static EdgeId reverseEdge(const StreetGraph* graph, NodeId from, NodeId to, EdgeId reverse);
 };
 
 // Passes const StreetMap* to m_sm
-PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm) : m_sm(sm)
+PointToPointRouterImpl::PointToPointRouterImpl(const StreetMap* sm) : m_sm(sm), m_mode(ROUTER_ASTAR), m_cache(nullptr), m_search(0)
 {
 }
 
@@ -43,151 +111,286 @@ PointToPointRouterImpl::~PointToPointRouterImpl()
 {
 }
 
-// Route computed by A* between start and end is stored and total distance is recorded
+// Route computed between start and end is stored and total distance is recorded
 DeliveryResult PointToPointRouterImpl::generatePointToPointRoute(
 	const GeoCoord& start,
 	const GeoCoord& end,
 	list<StreetSegment>& route,
 	double& totalDistanceTravelled) const
 {
+	NodeId startId;
+	DeliveryResult result = findPath(start, end, startId, totalDistanceTravelled);
+	if (result == DELIVERY_SUCCESS) {
+		buildRoute(m_sm->graph(), startId, route);
+	}
+	return result;
+}
+
+DeliveryResult PointToPointRouterImpl::generatePointToPointPath(
+	const GeoCoord& start,
+	const GeoCoord& end,
+	vector<unsigned int>& edges,
+	double& totalDistanceTravelled) const
+{
+	NodeId startId;
+	DeliveryResult result = findPath(start, end, startId, totalDistanceTravelled);
+	if (result == DELIVERY_SUCCESS) {
+		edges.assign(m_path.begin(), m_path.end());
+	}
+	return result;
+}
+
+DeliveryResult PointToPointRouterImpl::findPath(const GeoCoord& start, const GeoCoord& end, NodeId& startId,
+	double& totalDistanceTravelled) const
+{
+	const StreetGraph* graph = m_sm->graph();
+
 	// Check that the start and end coordinates are valid
-	vector<StreetSegment> segs;
-	// If no segments connect to the start or end, bad coordinates were passed
-	if (!m_sm->getSegmentsThatStartWith(start, segs) || !m_sm->getSegmentsThatStartWith(end, segs)) {
+	startId = graph->findNode(start);
+	NodeId endId = graph->findNode(end);
+	// If either isn't a vertex of the map, bad coordinates were passed
+	if (startId == StreetGraph::NO_NODE || endId == StreetGraph::NO_NODE) {
 		return BAD_COORD;
 	}
 
 	// If the start matches the end...
-	if (start == end) {
-		route.clear();
+	if (startId == endId) {
+		m_path.clear();
 		totalDistanceTravelled = 0;
 		return DELIVERY_SUCCESS;
 	}
 
-	// Initialized the start node and the open/closed lists (open gets start)
-	// Open list refers to the points that are yet to be explored (neighbors of what we've explored)
-	// Closed list refers to points already explored
-	PointNode* startNode = new PointNode{start, 0, 0, 0, nullptr, ""};
+	// Reuse a route found earlier if the cache has it, otherwise search and remember the result
+	if (m_cache == nullptr || !m_cache->lookup(graph, startId, endId, m_path, totalDistanceTravelled)) {
+		DeliveryResult result = search(graph, startId, endId, totalDistanceTravelled);
+		if (result != DELIVERY_SUCCESS) {
+			return result;
+		}
+		if (m_cache != nullptr) {
+			m_cache->insert(graph, startId, endId, m_path, totalDistanceTravelled);
+		}
+	}
+	return DELIVERY_SUCCESS;
+}
 
-	list<PointNode*> open;
-	list<PointNode*> closed;
+DeliveryResult PointToPointRouterImpl::search(const StreetGraph* graph, NodeId startId, NodeId endId,
+	double& totalDistanceTravelled) const
+{
+	// Use the contraction hierarchy if asked to and the map has one
+	const ContractionHierarchy* ch = m_sm->contractionHierarchy();
+	if (m_mode == ROUTER_CONTRACTION_HIERARCHY && ch != nullptr) {
+		return searchHierarchy(graph, ch, startId, endId, totalDistanceTravelled);
+	}
+	if (m_mode == ROUTER_BIDIRECTIONAL) {
+		return searchBidirectional(graph, startId, endId, totalDistanceTravelled);
+	}
+	return searchAStar(graph, startId, endId, totalDistanceTravelled);
+}
 
-	open.push_back(startNode);
+// A* from startId: the open set is keyed by f = g + h, where g is the distance travelled
+// so far and h (distance as the crow flies to the end) estimates what's left. If the map
+// has landmarks, h is the larger of that and the landmark bound (ALT).
+DeliveryResult PointToPointRouterImpl::searchAStar(const StreetGraph* graph, NodeId startId, NodeId endId,
+	double& totalDistanceTravelled) const
+{
+	const LandmarkTable* landmarks = m_sm->landmarks();
 
-	// While the open list isn't empty,
-	while (!open.empty()) {
-		// Find the node with the smallest f
-		double min_cost = 12500; // Approximately the longest possible distance between two points on Earth
-		list<PointNode*>::iterator min_i;
-		for (list<PointNode*>::iterator oi = open.begin(); oi != open.end(); ++oi) {
-			if ((*oi)->f_cost < min_cost) {
-				min_cost = (*oi)->f_cost;
-				min_i = oi;
-			}
-		}
-		// Node will be called parent from now on and removed from the open list
-		PointNode* parent = (*min_i);
-		open.erase(min_i);
+	// Open set gets the start
+	beginSearch(graph);
+	m_nodes[startId] = PointNode{ 0, StreetGraph::NO_NODE, 0, m_search, false };
+	m_open.pushOrDecrease(startId, heuristic(graph, landmarks, startId, endId));
 
-		// Closed takes the parent popped from open
-		closed.push_back(parent);
+	// While the open set isn't empty,
+	while (!m_open.empty()) {
+		// Take the node with the smallest f cost and close it
+		NodeId parent = m_open.pop();
+		PointNode& parentNode = m_nodes[parent];
+		parentNode.closed = true;
 
-		// Get the segments from this point
-		m_sm->getSegmentsThatStartWith(parent->gc, segs);
+		// The first time the end is taken off the open set its g cost is the shortest distance
+		if (parent == endId) {
+			totalDistanceTravelled = parentNode.g_cost;
+			buildPath(endId);
+			return DELIVERY_SUCCESS;
+		}
 
 		// For all adjacent points...
-		for (vector<StreetSegment>::iterator vi = segs.begin(); vi != segs.end(); ++vi) {
-			GeoCoord next{ vi->end.latitudeText, vi->end.longitudeText };
-			string nextName = vi->name;
-
-			// If the point is the goal, stop the search
-			if (next == end) {
-				// Empty the route of any existing street segments
-				route.clear();
-
-				// Total distance is distance from the end plus the g_cost of the parent (g_cost is distance from the start to the parent)
-				totalDistanceTravelled = distanceEarthMiles(end, parent->gc) + parent->g_cost;
-
-				// Last segment is between the parent and end, with its name conveniently in nextName
-				StreetSegment lastSeg{ parent->gc, end, nextName };
-				route.push_front(lastSeg);
-
-				// While there's a previous coordinate...
-				while (parent->parent != nullptr) {
-					// Add the segment to the route
-					StreetSegment newSeg{ parent->parent->gc, parent->gc, parent->name };
-					route.push_front(newSeg);
-					parent = parent->parent;
-				}
-				// Free dynamically allocated array in open and closed arrays
-				for (list<PointNode*>::iterator oi = open.begin(); oi != open.end(); ++oi) {
-					delete (*oi);
-				}
-
-				for (list<PointNode*>::iterator ci = closed.begin(); ci != closed.end(); ++ci) {
-					delete (*ci);
-				}
-
-				return DELIVERY_SUCCESS;
+		for (StreetGraph::EdgeView edge : graph->edges(parent)) {
+			NodeId next = edge.target;
+			PointNode& nextNode = m_nodes[next];
+			bool reached = nextNode.search == m_search;
+			// Closed nodes already have their shortest distance
+			if (reached && nextNode.closed) {
+				continue;
 			}
 
-			// Otherwise...
-			// G cost is the parent's g cost + distance between parent and adjacent node
-			double g_cost = distanceEarthMiles(next, parent->gc) + parent->g_cost;
-			// H cost is the distance from the point to the end (heuristic for what it will take to get to the end)
-			double h_cost = distanceEarthMiles(next, end);
-			// F cost is G cost + H cost
-			double f_cost = g_cost + h_cost;
-
-			// Build a new PointNode with the parameters
-			PointNode* newNextNode = new PointNode{ next, f_cost, g_cost, h_cost, parent, nextName};
-
-			bool addNode = true;
-			bool keep = false;
-			// Check for node with same position as successor in open list
-			for (list<PointNode*>::iterator oi = open.begin(); oi != open.end(); ++oi) {
-				if ((*oi)->gc == next) {
-					addNode = false;
-					// If it's already in the list with a greater f cost
-					if ((*oi)->f_cost > f_cost) {
-						delete (*oi);
-						*oi = newNextNode;
-						keep = true;
-					}
-					break;
-				}
+			// G cost is the parent's g cost + length of the edge between them
+			double g_cost = parentNode.g_cost + edge.length;
+			// Only keep this path if it beats the best one found so far
+			if (reached && g_cost >= nextNode.g_cost) {
+				continue;
 			}
+			nextNode = PointNode{ g_cost, parent, edge.id, m_search, false };
 
-			// Check for node with same position as successor in closed list
-			for (list<PointNode*>::iterator ci = closed.begin(); ci != closed.end(); ++ci) {
-				if ((*ci)->gc == next) {
-					addNode = false;
-					// If it's already there with bigger f
-					if ((*ci)->f_cost > f_cost) {
-						delete (*ci);
-						*ci = newNextNode;
-						keep = true;
-					}
-					break;
-				}
-			}
+			// F cost is G cost + H cost; insert into the open set or lower its key
+			double h_cost = heuristic(graph, landmarks, next, endId);
+			m_open.pushOrDecrease(next, g_cost + h_cost);
+		}
+	}
+	// No route was found
+	return NO_ROUTE;
+}
+
+// Bidirectional A*: a forward search from the start and a backward one from the end (every street
+// is two-way, so the backward search can follow the same edges). Both use the average potential
+// p(v) = (h(v, end) - h(start, v)) / 2, which makes reduced edge lengths the same from either side:
+// forward keys are g + p and backward keys g - p. Whenever one search reaches a node the other one
+// has reached, the two g costs make a start-to-end candidate, and once the two smallest keys add up
+// to at least the best candidate, no shorter route is left to find.
+DeliveryResult PointToPointRouterImpl::searchBidirectional(const StreetGraph* graph, NodeId startId, NodeId endId,
+	double& totalDistanceTravelled) const
+{
+	const LandmarkTable* landmarks = m_sm->landmarks();
+	beginSearch(graph);
+	vector<PointNode>* nodes[2] = { &m_nodes, &m_reverseNodes };
+	IndexedMinHeap* open[2] = { &m_open, &m_reverseOpen };
+	NodeId roots[2] = { startId, endId };
+	const double sign[2] = { 1, -1 };
+	for (int d = 0; d < 2; ++d) {
+		(*nodes[d])[roots[d]] = PointNode{ 0, StreetGraph::NO_NODE, 0, m_search, false };
+		double p = (heuristic(graph, landmarks, roots[d], endId) - heuristic(graph, landmarks, startId, roots[d])) / 2;
+		open[d]->pushOrDecrease(roots[d], sign[d] * p);
+	}
+
+	double best = 0;
+	NodeId meet = StreetGraph::NO_NODE;
+	while (!open[0]->empty() && !open[1]->empty()) {
+		if (meet != StreetGraph::NO_NODE && open[0]->topKey() + open[1]->topKey() >= best) {
+			break;
+		}
+		// Expand the side with the smaller key
+		int d = open[0]->topKey() <= open[1]->topKey() ? 0 : 1;
+		vector<PointNode>& side = *nodes[d];
+		const vector<PointNode>& otherSide = *nodes[1 - d];
+		NodeId parent = open[d]->pop();
+		side[parent].closed = true;
+		double parentCost = side[parent].g_cost;
 
-			// Node wasn't in closed/open lists and should be added
-			if (addNode) {
-				keep = true;
-				open.push_back(newNextNode);
+		for (StreetGraph::EdgeView edge : graph->edges(parent)) {
+			NodeId next = edge.target;
+			PointNode& nextNode = side[next];
+			bool reached = nextNode.search == m_search;
+			if (reached && nextNode.closed) {
+				continue;
+			}
+			double g_cost = parentCost + edge.length;
+			if (reached && g_cost >= nextNode.g_cost) {
+				continue;
 			}
-			if (!keep) {
-				delete newNextNode;
+			nextNode = PointNode{ g_cost, parent, edge.id, m_search, false };
+			double p = (heuristic(graph, landmarks, next, endId) - heuristic(graph, landmarks, startId, next)) / 2;
+			open[d]->pushOrDecrease(next, g_cost + sign[d] * p);
+
+			// Did this reach a node the other side has reached?
+			const PointNode& other = otherSide[next];
+			if (other.search == m_search && (meet == StreetGraph::NO_NODE || g_cost + other.g_cost < best)) {
+				best = g_cost + other.g_cost;
+				meet = next;
 			}
 		}
 	}
-	// Free everything in the closed list (open list is already empty if we're here)
-	for (list<PointNode*>::iterator ci = closed.begin(); ci != closed.end(); ++ci) {
-		delete (*ci);
+	if (meet == StreetGraph::NO_NODE) {
+		return NO_ROUTE;
+	}
+
+	// Start -> meet from the forward parents, then meet -> end from the backward ones
+	buildPath(meet);
+	for (NodeId n = meet; m_reverseNodes[n].parent != StreetGraph::NO_NODE; n = m_reverseNodes[n].parent) {
+		NodeId towardEnd = m_reverseNodes[n].parent;
+		m_path.push_back(reverseEdge(graph, n, towardEnd, m_reverseNodes[n].parentEdge));
+	}
+	// Sum edge by edge like A* does, so both modes report the same distance for the same route
+	double total = 0;
+	for (size_t i = 0; i < m_path.size(); ++i) {
+		total += graph->edgeLength(m_path[i]);
+	}
+	totalDistanceTravelled = total;
+	return DELIVERY_SUCCESS;
+}
+
+// Upward bidirectional search in the hierarchy, then shortcuts are unpacked into street segments
+DeliveryResult PointToPointRouterImpl::searchHierarchy(const StreetGraph* graph, const ContractionHierarchy* ch, NodeId startId, NodeId endId,
+	double& totalDistanceTravelled) const
+{
+	double distance;
+	if (!m_chQuery.run(*ch, startId, endId, m_chPath, distance)) {
+		return NO_ROUTE;
+	}
+	m_path.clear();
+	double total = 0;
+	for (size_t i = 0; i < m_chPath.size(); ++i) {
+		m_path.push_back(m_chPath[i].edge);
+		total += graph->edgeLength(m_chPath[i].edge);
+	}
+	// Sum edge by edge like A* does, so both modes report the same distance for the same route
+	totalDistanceTravelled = total;
+	return DELIVERY_SUCCESS;
+}
+
+// Resizes the state for a newly loaded graph, otherwise just bumps the search number
+void PointToPointRouterImpl::beginSearch(const StreetGraph* graph) const
+{
+	m_open.clear();
+	m_reverseOpen.clear();
+	if (m_nodes.size() != graph->nodeCount() || m_search == 0xFFFFFFFFu) {
+		m_nodes.assign(graph->nodeCount(), PointNode{ 0, StreetGraph::NO_NODE, 0, 0, false });
+		m_reverseNodes.assign(graph->nodeCount(), PointNode{ 0, StreetGraph::NO_NODE, 0, 0, false });
+		m_open.resize(graph->nodeCount());
+		m_reverseOpen.resize(graph->nodeCount());
+		m_search = 0;
+	}
+	++m_search;
+}
+
+// Walks parent links from goal back to the start, then puts the edges in start-to-goal order
+void PointToPointRouterImpl::buildPath(NodeId goal) const
+{
+	m_path.clear();
+	// While there's a previous coordinate...
+	for (NodeId n = goal; m_nodes[n].parent != StreetGraph::NO_NODE; n = m_nodes[n].parent) {
+		m_path.push_back(m_nodes[n].parentEdge);
+	}
+	reverse(m_path.begin(), m_path.end());
+}
+
+// Materializes the segments of m_path, following it from the start
+void PointToPointRouterImpl::buildRoute(const StreetGraph* graph, NodeId startId, list<StreetSegment>& route) const
+{
+	// Empty the route of any existing street segments
+	route.clear();
+	NodeId from = startId;
+	for (size_t i = 0; i < m_path.size(); ++i) {
+		route.push_back(graph->segment(from, m_path[i]));
+		from = graph->edgeTarget(m_path[i]);
 	}
-	// No route was found
-	return NO_ROUTE;
+}
+
+// StreetMap::load adds every segment in both directions, so this always finds a match
+StreetGraph::EdgeId PointToPointRouterImpl::reverseEdge(const StreetGraph* graph, NodeId from, NodeId to, EdgeId reverse)
+{
+	EdgeId found = graph->edgeEnd(from);
+	for (StreetGraph::EdgeView edge : graph->edges(from)) {
+		if (edge.target != to) {
+			continue;
+		}
+		if (edge.name == graph->edgeName(reverse) && edge.length == graph->edgeLength(reverse)) {
+			return edge.id;
+		}
+		if (found == graph->edgeEnd(from)) {
+			found = edge.id;
+		}
+	}
+	return found;
 }
 
 //******************** PointToPointRouter functions ***************************
@@ -213,3 +416,32 @@ DeliveryResult PointToPointRouter::generatePointToPointRoute(
 {
 	return m_impl->generatePointToPointRoute(start, end, route, totalDistanceTravelled);
 }
+
+DeliveryResult PointToPointRouter::generatePointToPointPath(
+	const GeoCoord& start,
+	const GeoCoord& end,
+	vector<unsigned int>& edges,
+	double& totalDistanceTravelled) const
+{
+	return m_impl->generatePointToPointPath(start, end, edges, totalDistanceTravelled);
+}
+
+void PointToPointRouter::setMode(RouterMode mode)
+{
+	m_impl->setMode(mode);
+}
+
+RouterMode PointToPointRouter::mode() const
+{
+	return m_impl->mode();
+}
+
+void PointToPointRouter::setCache(RouteCache* cache)
+{
+	m_impl->setCache(cache);
+}
+
+RouteCache* PointToPointRouter::cache() const
+{
+	return m_impl->cache();
+}
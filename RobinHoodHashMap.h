@@ -0,0 +1,331 @@
+#ifndef RHHM_H_
+#define RHHM_H_
+
+// RobinHoodHashMap.h
+
+// Open-addressing counterpart of ExpandableHashMap with the same associate/find
+// interface and the same global hasher() functions, plus emplace, insert, reserve
+// and erase. Entries live directly in one array of slots, probed linearly from the
+// slot their hash picks. On insertion an entry that is further from its own slot
+// takes the place of one that is closer to its own ("Robin Hood" hashing), which
+// keeps probe sequences short and lets an unsuccessful find stop early. Erasing
+// shifts the following entries back instead of leaving tombstones.
+// A small array beside the entries holds each slot's full hash and probe length,
+// so probing only reads keys whose hash already matches.
+// Pointers returned by find, insert and emplace stay valid until the map grows
+// (any insertion may grow it unless reserve() made room) or the entry is erased.
+
+#include <new>
+#include <utility>
+
+template<typename KeyType, typename ValueType>
+class RobinHoodHashMap
+{
+public:
+	RobinHoodHashMap(double maximumLoadFactor = 0.8); // constructor
+	~RobinHoodHashMap(); // destructor; deletes all items in the hashmap
+	void reset(); // resets the hashmap back to 8 slots; deletes all items
+	int size() const; // returns the number of associations in the hashmap
+
+	// Associates key with value, replacing the value already associated with key if there is one
+	void associate(const KeyType& key, const ValueType& value);
+
+	// Adds key with a value constructed from args if key isn't in the map yet.
+	// Returns a pointer to key's value and whether it was added; if key was
+	// already there its value is left alone and args aren't used.
+	template<typename K, typename... Args>
+	std::pair<ValueType*, bool> emplace(K&& key, Args&&... args);
+	// emplace() with a ready-made value, moved in if it's an rvalue
+	template<typename K, typename V>
+	std::pair<ValueType*, bool> insert(K&& key, V&& value)
+	{
+		return emplace(std::forward<K>(key), std::forward<V>(value));
+	}
+
+	// Makes room for count associations so that adding them won't rehash
+	void reserve(unsigned int count);
+
+	// Removes key's association; returns false if there wasn't one
+	bool erase(const KeyType& key);
+
+	// If no association exists with the given key, return nullptr; otherwise,
+	// return a pointer to the value associated with that key.
+	const ValueType* find(const KeyType& key) const;
+	ValueType* find(const KeyType& key)
+	{
+		return const_cast<ValueType*>(const_cast<const RobinHoodHashMap*>(this)->find(key));
+	}
+
+	// C++11 syntax for preventing copying and assignment
+	RobinHoodHashMap(const RobinHoodHashMap&) = delete;
+	RobinHoodHashMap& operator=(const RobinHoodHashMap&) = delete;
+
+private:
+	struct Entry {
+		KeyType key;
+		ValueType value;
+		template<typename K, typename... Args>
+		Entry(int, K&& k, Args&&... args) : key(std::forward<K>(k)), value(std::forward<Args>(args)...) {}
+	};
+	// probe is 0 for an empty slot, otherwise 1 + how far the entry is from the slot its hash picks
+	struct Slot {
+		unsigned int hash;
+		unsigned int probe;
+	};
+
+	unsigned int m_capacity; // always a power of 2
+	unsigned int m_shift; // 32 - log2(m_capacity)
+	unsigned int m_assoc;
+	double m_load;
+	Slot* m_slots;
+	Entry* m_entries; // raw storage; only slots with a nonzero probe hold a constructed Entry
+
+	static unsigned int hashOf(const KeyType& key)
+	{
+		unsigned int hasher(const KeyType& k); // prototype
+		return hasher(key);
+	}
+	// Slot a hash starts probing from: Fibonacci hashing spreads weak hashes over the top bits
+	unsigned int home(unsigned int hash) const { return (hash * 2654435769u) >> m_shift; }
+	// Smallest power of 2 (no smaller than now) that holds count associations under the load factor
+	unsigned int capacityFor(unsigned int count) const
+	{
+		unsigned int capacity = m_capacity;
+		while (count > double(capacity) * m_load && capacity < 0x80000000u) {
+			capacity *= 2;
+		}
+		return capacity;
+	}
+	enum { NOT_FOUND = 0xFFFFFFFFu };
+	// Slot holding key, whose hasher() value is hash, or NOT_FOUND
+	unsigned int findSlot(const KeyType& key, unsigned int hash) const;
+
+	// Allocates capacity empty slots
+	void allocate(unsigned int capacity);
+	// Destroys every entry and frees the slots
+	void release();
+	// Moves every entry into a table with the given capacity
+	void rehash(unsigned int capacity);
+	// Frees up the slot a new entry with this hash belongs in, pushing richer entries along,
+	// and returns it with the new entry's probe length. The caller constructs the entry there.
+	unsigned int makeRoom(unsigned int hash, unsigned int& probe);
+};
+
+// RHHM has 8 slots and no associations
+template<typename KeyType, typename ValueType>
+RobinHoodHashMap<KeyType, ValueType>::RobinHoodHashMap(double maximumLoadFactor)
+	: m_capacity(0), m_shift(32), m_assoc(0), m_load(maximumLoadFactor), m_slots(nullptr), m_entries(nullptr)
+{
+	// If load isn't between 0 and 1, set it to the default of 0.8
+	if (maximumLoadFactor <= 0 || maximumLoadFactor >= 1) {
+		m_load = 0.8;
+	}
+	allocate(8);
+}
+
+template<typename KeyType, typename ValueType>
+RobinHoodHashMap<KeyType, ValueType>::~RobinHoodHashMap()
+{
+	release();
+}
+
+// Resets the RHHM to 8 slots and no associations
+template<typename KeyType, typename ValueType>
+void RobinHoodHashMap<KeyType, ValueType>::reset()
+{
+	release();
+	allocate(8);
+}
+
+// Returns number of associations made in map
+template<typename KeyType, typename ValueType>
+int RobinHoodHashMap<KeyType, ValueType>::size() const
+{
+	return m_assoc;
+}
+
+// Associates a given key with a given value
+template<typename KeyType, typename ValueType>
+void RobinHoodHashMap<KeyType, ValueType>::associate(const KeyType& key, const ValueType& value)
+{
+	std::pair<ValueType*, bool> result = emplace(key, value);
+	// If the key was already there, update its value
+	if (!result.second) {
+		*result.first = value;
+	}
+}
+
+template<typename KeyType, typename ValueType>
+template<typename K, typename... Args>
+std::pair<ValueType*, bool> RobinHoodHashMap<KeyType, ValueType>::emplace(K&& key, Args&&... args)
+{
+	// If the key is already there, leave it alone
+	unsigned int hash = hashOf(key);
+	unsigned int found = findSlot(key, hash);
+	if (found != NOT_FOUND) {
+		return std::make_pair(&m_entries[found].value, false);
+	}
+
+	// Otherwise, make a new association, doubling the slots first if the load would be exceeded
+	unsigned int capacity = capacityFor(m_assoc + 1);
+	if (capacity != m_capacity) {
+		rehash(capacity);
+	}
+	unsigned int probe;
+	unsigned int i = makeRoom(hash, probe);
+	new (&m_entries[i]) Entry(0, std::forward<K>(key), std::forward<Args>(args)...);
+	m_slots[i].hash = hash;
+	m_slots[i].probe = probe;
+	++m_assoc;
+	return std::make_pair(&m_entries[i].value, true);
+}
+
+// Grows the table until count associations fit under the load factor
+template<typename KeyType, typename ValueType>
+void RobinHoodHashMap<KeyType, ValueType>::reserve(unsigned int count)
+{
+	unsigned int capacity = capacityFor(count);
+	if (capacity != m_capacity) {
+		rehash(capacity);
+	}
+}
+
+// Removes key, then shifts the entries after it back by one until one is in its own slot
+template<typename KeyType, typename ValueType>
+bool RobinHoodHashMap<KeyType, ValueType>::erase(const KeyType& key)
+{
+	unsigned int i = findSlot(key, hashOf(key));
+	if (i == NOT_FOUND) {
+		return false;
+	}
+	unsigned int mask = m_capacity - 1;
+	m_entries[i].~Entry();
+	for (unsigned int next = (i + 1) & mask; m_slots[next].probe > 1; next = (next + 1) & mask) {
+		new (&m_entries[i]) Entry(std::move(m_entries[next]));
+		m_entries[next].~Entry();
+		m_slots[i].hash = m_slots[next].hash;
+		m_slots[i].probe = m_slots[next].probe - 1;
+		i = next;
+	}
+	m_slots[i].probe = 0;
+	--m_assoc;
+	return true;
+}
+
+// Returns ptr to value if key is in the map or nullptr otherwise
+template<typename KeyType, typename ValueType>
+const ValueType* RobinHoodHashMap<KeyType, ValueType>::find(const KeyType& key) const
+{
+	unsigned int i = findSlot(key, hashOf(key));
+	return i == NOT_FOUND ? nullptr : &m_entries[i].value;
+}
+
+template<typename KeyType, typename ValueType>
+unsigned int RobinHoodHashMap<KeyType, ValueType>::findSlot(const KeyType& key, unsigned int hash) const
+{
+	unsigned int mask = m_capacity - 1;
+	unsigned int i = home(hash);
+	// Once a slot's entry is closer to its own slot than key would be here, key isn't in the map
+	for (unsigned int probe = 1; m_slots[i].probe >= probe; ++probe) {
+		if (m_slots[i].hash == hash && m_entries[i].key == key) {
+			return i;
+		}
+		i = (i + 1) & mask;
+	}
+	return NOT_FOUND;
+}
+
+template<typename KeyType, typename ValueType>
+void RobinHoodHashMap<KeyType, ValueType>::allocate(unsigned int capacity)
+{
+	m_capacity = capacity;
+	m_shift = 32;
+	for (unsigned int c = capacity; c > 1; c /= 2) {
+		--m_shift;
+	}
+	m_assoc = 0;
+	m_slots = new Slot[capacity];
+	for (unsigned int i = 0; i < capacity; ++i) {
+		m_slots[i].hash = 0;
+		m_slots[i].probe = 0;
+	}
+	m_entries = static_cast<Entry*>(::operator new(sizeof(Entry) * capacity));
+}
+
+template<typename KeyType, typename ValueType>
+void RobinHoodHashMap<KeyType, ValueType>::release()
+{
+	for (unsigned int i = 0; i < m_capacity; ++i) {
+		if (m_slots[i].probe != 0) {
+			m_entries[i].~Entry();
+		}
+	}
+	delete[] m_slots;
+	::operator delete(m_entries);
+	m_slots = nullptr;
+	m_entries = nullptr;
+	m_capacity = 0;
+	m_assoc = 0;
+}
+
+template<typename KeyType, typename ValueType>
+void RobinHoodHashMap<KeyType, ValueType>::rehash(unsigned int capacity)
+{
+	Slot* oldSlots = m_slots;
+	Entry* oldEntries = m_entries;
+	unsigned int oldCapacity = m_capacity;
+	unsigned int assoc = m_assoc;
+	allocate(capacity);
+	// The stored hashes mean no key gets hashed again
+	for (unsigned int i = 0; i < oldCapacity; ++i) {
+		if (oldSlots[i].probe != 0) {
+			unsigned int probe;
+			unsigned int j = makeRoom(oldSlots[i].hash, probe);
+			new (&m_entries[j]) Entry(std::move(oldEntries[i]));
+			m_slots[j].hash = oldSlots[i].hash;
+			m_slots[j].probe = probe;
+			oldEntries[i].~Entry();
+		}
+	}
+	m_assoc = assoc;
+	delete[] oldSlots;
+	::operator delete(oldEntries);
+}
+
+template<typename KeyType, typename ValueType>
+unsigned int RobinHoodHashMap<KeyType, ValueType>::makeRoom(unsigned int hash, unsigned int& probe)
+{
+	unsigned int mask = m_capacity - 1;
+	unsigned int i = home(hash);
+	probe = 1;
+	// Skip entries that are at least as far from their own slot as the new one would be
+	while (m_slots[i].probe != 0 && m_slots[i].probe >= probe) {
+		i = (i + 1) & mask;
+		++probe;
+	}
+	if (m_slots[i].probe == 0) {
+		return i;
+	}
+
+	// The entry here is closer to its slot, so the new one takes its place and it moves on,
+	// in turn displacing any closer entries it meets until it finds an empty slot
+	Entry carried(std::move(m_entries[i]));
+	m_entries[i].~Entry();
+	Slot carriedSlot = m_slots[i];
+	m_slots[i].probe = 0;
+	for (unsigned int j = (i + 1) & mask; ; j = (j + 1) & mask) {
+		++carriedSlot.probe;
+		if (m_slots[j].probe == 0) {
+			new (&m_entries[j]) Entry(std::move(carried));
+			m_slots[j] = carriedSlot;
+			break;
+		}
+		if (m_slots[j].probe < carriedSlot.probe) {
+			std::swap(carried, m_entries[j]);
+			std::swap(carriedSlot, m_slots[j]);
+		}
+	}
+	return i;
+}
+
+#endif
@@ -0,0 +1,153 @@
+// RouteCache.cpp
+
+#include "RouteCache.h"
+#include <utility>
+using namespace std;
+
+// Hash function for the (start, end) keys: the 64-bit finalizer of MurmurHash3, as keyHash in
+// StreetGraph.cpp uses, so a route and its reverse (start ^ end alike) land far apart
+unsigned int hasher(const uint64_t& key)
+{
+	uint64_t h = key;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return (unsigned int)h;
+}
+
+RouteCache::RouteCache(size_t maxBytes)
+	: m_checksum(0), m_capacity(maxBytes), m_bytes(0), m_hits(0), m_misses(0), m_evictions(0)
+{
+}
+
+bool RouteCache::lookup(const StreetGraph* graph, NodeId start, NodeId end, vector<EdgeId>& path, double& distance)
+{
+	lock_guard<mutex> lock(m_mutex);
+	checkGraph(graph);
+	list<Entry>::iterator* it = m_index.find(makeKey(start, end));
+	if (it == nullptr) {
+		++m_misses;
+		return false;
+	}
+	// Move the entry to the front of the LRU list
+	m_lru.splice(m_lru.begin(), m_lru, *it);
+	path = (*it)->path;
+	distance = (*it)->distance;
+	++m_hits;
+	return true;
+}
+
+void RouteCache::insert(const StreetGraph* graph, NodeId start, NodeId end, const vector<EdgeId>& path, double distance)
+{
+	Entry entry = { makeKey(start, end), distance, path };
+	size_t bytes = entryBytes(entry);
+
+	lock_guard<mutex> lock(m_mutex);
+	checkGraph(graph);
+	// Another thread may have cached the same route in the meantime
+	list<Entry>::iterator* it = m_index.find(entry.key);
+	if (it != nullptr) {
+		m_lru.splice(m_lru.begin(), m_lru, *it);
+		return;
+	}
+	// A route too big for the whole cache isn't worth flushing everything for
+	if (bytes > m_capacity) {
+		return;
+	}
+	evictTo(m_capacity - bytes);
+	uint64_t key = entry.key;
+	m_lru.push_front(move(entry));
+	m_index.associate(key, m_lru.begin());
+	m_bytes += bytes;
+}
+
+void RouteCache::clear()
+{
+	lock_guard<mutex> lock(m_mutex);
+	removeAll();
+}
+
+void RouteCache::setCapacity(size_t maxBytes)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_capacity = maxBytes;
+	evictTo(m_capacity);
+}
+
+size_t RouteCache::capacity() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_capacity;
+}
+
+size_t RouteCache::bytesUsed() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_bytes;
+}
+
+size_t RouteCache::size() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return (size_t)m_index.size();
+}
+
+unsigned long long RouteCache::hits() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_hits;
+}
+
+unsigned long long RouteCache::misses() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_misses;
+}
+
+unsigned long long RouteCache::evictions() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_evictions;
+}
+
+void RouteCache::resetCounters()
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_hits = m_misses = m_evictions = 0;
+}
+
+// The entry itself, its edges, two list links and roughly one index slot
+size_t RouteCache::entryBytes(const Entry& entry)
+{
+	return sizeof(Entry) + entry.path.size() * sizeof(EdgeId) + 2 * sizeof(void*)
+		+ 2 * (sizeof(uint64_t) + sizeof(list<Entry>::iterator));
+}
+
+// Entries from another graph refer to nodes and edges that no longer mean the same thing
+void RouteCache::checkGraph(const StreetGraph* graph)
+{
+	if (graph->checksum() != m_checksum) {
+		removeAll();
+		m_checksum = graph->checksum();
+	}
+}
+
+void RouteCache::removeAll()
+{
+	m_lru.clear();
+	m_index.reset();
+	m_bytes = 0;
+}
+
+// Drops least recently used entries until at most maxBytes are used
+void RouteCache::evictTo(size_t maxBytes)
+{
+	while (m_bytes > maxBytes && !m_lru.empty()) {
+		m_bytes -= entryBytes(m_lru.back());
+		m_index.erase(m_lru.back().key);
+		m_lru.pop_back();
+		++m_evictions;
+	}
+}
@@ -0,0 +1,76 @@
+#ifndef RC_H_
+#define RC_H_
+
+// RouteCache.h
+
+// Bounded least-recently-used cache of shortest routes, keyed by (start node, end node).
+// A route is kept as the list of edges it follows from the start, plus the distance the
+// router reported for it, so replaying it gives exactly what the search gave. Once the
+// entries take more than the memory cap, the least recently used ones are evicted.
+// Entries belong to the graph they were found on: a lookup or insert with a graph whose
+// checksum differs (a different map was loaded) empties the cache first.
+// All functions can be called from several threads at once.
+
+#include "StreetGraph.h"
+#include "RobinHoodHashMap.h"
+#include <vector>
+#include <list>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+class RouteCache
+{
+public:
+	typedef StreetGraph::NodeId NodeId;
+	typedef StreetGraph::EdgeId EdgeId;
+
+	// maxBytes caps the approximate memory taken by the entries
+	RouteCache(size_t maxBytes = 16 * 1024 * 1024);
+
+	// Copies the route from start to end into path and distance; false if it isn't cached
+	bool lookup(const StreetGraph* graph, NodeId start, NodeId end, std::vector<EdgeId>& path, double& distance);
+	// Adds or refreshes the route from start to end, evicting old routes to make room
+	void insert(const StreetGraph* graph, NodeId start, NodeId end, const std::vector<EdgeId>& path, double distance);
+	// Removes every entry; the counters are kept
+	void clear();
+
+	void setCapacity(size_t maxBytes); // evicts right away if needed
+	size_t capacity() const;
+	size_t bytesUsed() const;
+	size_t size() const;
+
+	unsigned long long hits() const;
+	unsigned long long misses() const;
+	unsigned long long evictions() const;
+	void resetCounters();
+
+	// We prevent a RouteCache object from being copied or assigned.
+	RouteCache(const RouteCache&) = delete;
+	RouteCache& operator=(const RouteCache&) = delete;
+
+private:
+	struct Entry {
+		uint64_t key;
+		double distance;
+		std::vector<EdgeId> path;
+	};
+
+	mutable std::mutex m_mutex; // guards everything below
+	std::list<Entry> m_lru; // most recently used first
+	RobinHoodHashMap<uint64_t, std::list<Entry>::iterator> m_index;
+	uint64_t m_checksum; // checksum of the graph the entries were found on
+	size_t m_capacity;
+	size_t m_bytes;
+	unsigned long long m_hits, m_misses, m_evictions;
+
+	static uint64_t makeKey(NodeId start, NodeId end) { return (uint64_t)start << 32 | end; }
+	// Memory charged for an entry, including list and index overhead
+	static size_t entryBytes(const Entry& entry);
+	// The following assume m_mutex is held
+	void checkGraph(const StreetGraph* graph);
+	void removeAll();
+	void evictTo(size_t maxBytes);
+};
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef RM_H_
+#define RM_H_
+
+// RouterMode.h
+
+// Search used by PointToPointRouter (see PointToPointRouter::setMode). Every mode
+// returns a shortest route.
+enum RouterMode : int
+{
+	ROUTER_ASTAR, // A* over the whole street graph, with landmark bounds if the map has them
+	ROUTER_BIDIRECTIONAL, // A* from both ends at once, meeting in the middle
+	ROUTER_CONTRACTION_HIERARCHY // upward search in the map's contraction hierarchy (A* if it has none)
+};
+
+#endif
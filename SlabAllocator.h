@@ -0,0 +1,78 @@
+#ifndef SA_H_
+#define SA_H_
+
+// SlabAllocator.h
+
+// Node allocators for ExpandableHashMap. An allocator hands out uninitialized storage
+// for one T at a time (allocate). If FREES_IN_BULK is nonzero, releaseAll() reclaims
+// everything it ever handed out at once, so a container only has to destroy its objects
+// (if they need it). Otherwise each one's storage goes back through deallocate().
+
+#include <vector>
+#include <cstddef>
+
+// Carves storage out of slabs that double in size up to a limit. Nothing is given back
+// until releaseAll(), which suits ExpandableHashMap: it never removes a single node.
+template<typename T>
+class SlabAllocator
+{
+public:
+	enum { FREES_IN_BULK = 1 };
+
+	SlabAllocator() : m_used(0), m_slabSize(0) {}
+	~SlabAllocator() { releaseAll(); }
+
+	T* allocate()
+	{
+		if (m_used == m_slabSize) {
+			// Start a new slab, twice as big as the last one
+			m_slabSize = m_slabSize == 0 ? FIRST_SLAB : (m_slabSize < MAX_SLAB ? m_slabSize * 2 : MAX_SLAB);
+			m_slabs.push_back(new Cell[m_slabSize]);
+			m_used = 0;
+		}
+		return reinterpret_cast<T*>(&m_slabs.back()[m_used++]);
+	}
+
+	// Frees every slab; anything allocated must already have been destroyed
+	void releaseAll()
+	{
+		for (size_t i = 0; i < m_slabs.size(); ++i) {
+			delete[] m_slabs[i];
+		}
+		m_slabs.clear();
+		m_used = m_slabSize = 0;
+	}
+
+	// We prevent a SlabAllocator object from being copied or assigned.
+	SlabAllocator(const SlabAllocator&) = delete;
+	SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+private:
+	static const size_t FIRST_SLAB = 64;
+	static const size_t MAX_SLAB = 8192;
+	// Room for one T
+	struct Cell {
+		alignas(T) unsigned char storage[sizeof(T)];
+	};
+	std::vector<Cell*> m_slabs;
+	size_t m_used; // cells handed out from the newest slab
+	size_t m_slabSize; // cells in the newest slab
+};
+
+template<typename T>
+const size_t SlabAllocator<T>::FIRST_SLAB;
+template<typename T>
+const size_t SlabAllocator<T>::MAX_SLAB;
+
+// Plain operator new / delete for every node
+template<typename T>
+class HeapAllocator
+{
+public:
+	enum { FREES_IN_BULK = 0 };
+	T* allocate() { return static_cast<T*>(::operator new(sizeof(T))); }
+	void deallocate(T* p) { ::operator delete(p); }
+	void releaseAll() {}
+};
+
+#endif
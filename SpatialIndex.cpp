@@ -0,0 +1,213 @@
+// SpatialIndex.cpp
+
+#include "SpatialIndex.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+using namespace std;
+
+namespace
+{
+	// Miles per degree of latitude, on the same sphere as distanceEarthKM
+	const double MILES_PER_DEGREE = 6371.0 * 4 * atan(1.0) / 180 / 1.609344;
+}
+
+SpatialIndex::SpatialIndex() : m_graph(nullptr), m_xScale(1)
+{
+}
+
+void SpatialIndex::clear()
+{
+	m_graph = nullptr;
+	m_xScale = 1;
+	m_x.clear();
+	m_y.clear();
+	m_nodeTree.nodes.clear();
+	m_nodeTree.items.clear();
+	m_segmentTree.nodes.clear();
+	m_segmentTree.items.clear();
+	m_segmentFrom.clear();
+	m_segmentEdge.clear();
+}
+
+void SpatialIndex::build(const StreetGraph* graph)
+{
+	clear();
+	unsigned int n = graph->nodeCount();
+	if (n == 0) {
+		return;
+	}
+	m_graph = graph;
+
+	// Project every node
+	double latSum = 0;
+	for (NodeId u = 0; u < n; ++u) {
+		latSum += graph->latitude(u);
+	}
+	m_xScale = cos(latSum / n * 4 * atan(1.0) / 180);
+	m_x.resize(n);
+	m_y.resize(n);
+	vector<Box> boxes(n);
+	for (NodeId u = 0; u < n; ++u) {
+		m_x[u] = graph->longitude(u) * m_xScale;
+		m_y[u] = graph->latitude(u);
+		boxes[u] = Box{ m_x[u], m_y[u], m_x[u], m_y[u] };
+	}
+	buildTree(m_nodeTree, boxes);
+
+	// Every street is stored in both directions; index the direction leaving the lower node ID
+	boxes.clear();
+	for (NodeId u = 0; u < n; ++u) {
+		for (EdgeId e = graph->edgeBegin(u); e != graph->edgeEnd(u); ++e) {
+			NodeId v = graph->edgeTarget(e);
+			if (u < v) {
+				m_segmentFrom.push_back(u);
+				m_segmentEdge.push_back(e);
+				boxes.push_back(Box{ min(m_x[u], m_x[v]), min(m_y[u], m_y[v]), max(m_x[u], m_x[v]), max(m_y[u], m_y[v]) });
+			}
+		}
+	}
+	buildTree(m_segmentTree, boxes);
+}
+
+SpatialIndex::NodeId SpatialIndex::nearestNode(double lat, double lon, double radiusMiles, double& distanceMiles) const
+{
+	if (m_nodeTree.nodes.empty()) {
+		return StreetGraph::NO_NODE;
+	}
+	double x = lon * m_xScale;
+	double y = lat;
+	double radius = radiusMiles / MILES_PER_DEGREE;
+	double best = radius * radius;
+	unsigned int bestItem = NO_CHILD;
+	search(m_nodeTree, 0, x, y, [this, x, y](unsigned int u) {
+		double dx = m_x[u] - x;
+		double dy = m_y[u] - y;
+		return dx * dx + dy * dy;
+	}, best, bestItem);
+	if (bestItem == NO_CHILD) {
+		return StreetGraph::NO_NODE;
+	}
+	distanceMiles = sqrt(best) * MILES_PER_DEGREE;
+	return bestItem;
+}
+
+bool SpatialIndex::nearestSegmentPoint(double lat, double lon, double radiusMiles,
+	NodeId& from, EdgeId& edge, double& fraction, double& distanceMiles) const
+{
+	if (m_segmentTree.nodes.empty()) {
+		return false;
+	}
+	double x = lon * m_xScale;
+	double y = lat;
+	double radius = radiusMiles / MILES_PER_DEGREE;
+	double best = radius * radius;
+	unsigned int bestItem = NO_CHILD;
+	search(m_segmentTree, 0, x, y, [this, x, y](unsigned int s) {
+		double t;
+		return segmentDistance2(s, x, y, t);
+	}, best, bestItem);
+	if (bestItem == NO_CHILD) {
+		return false;
+	}
+	from = m_segmentFrom[bestItem];
+	edge = m_segmentEdge[bestItem];
+	segmentDistance2(bestItem, x, y, fraction);
+	distanceMiles = sqrt(best) * MILES_PER_DEGREE;
+	return true;
+}
+
+void SpatialIndex::buildTree(Tree& tree, const vector<Box>& boxes)
+{
+	tree.nodes.clear();
+	tree.items.resize(boxes.size());
+	for (size_t i = 0; i < boxes.size(); ++i) {
+		tree.items[i] = (unsigned int)i;
+	}
+	if (!boxes.empty()) {
+		buildRange(tree, boxes, 0, (unsigned int)boxes.size());
+	}
+}
+
+// Makes the tree node for items[begin, end), splitting at the median center along its longer side
+unsigned int SpatialIndex::buildRange(Tree& tree, const vector<Box>& boxes, unsigned int begin, unsigned int end)
+{
+	Box box = boxes[tree.items[begin]];
+	for (unsigned int i = begin + 1; i < end; ++i) {
+		const Box& b = boxes[tree.items[i]];
+		box.minX = min(box.minX, b.minX);
+		box.minY = min(box.minY, b.minY);
+		box.maxX = max(box.maxX, b.maxX);
+		box.maxY = max(box.maxY, b.maxY);
+	}
+	unsigned int index = (unsigned int)tree.nodes.size();
+	tree.nodes.push_back(TreeNode{ box, begin, end, NO_CHILD, NO_CHILD });
+	if (end - begin <= LEAF_SIZE) {
+		return index;
+	}
+
+	unsigned int mid = begin + (end - begin) / 2;
+	if (box.maxX - box.minX >= box.maxY - box.minY) {
+		nth_element(tree.items.begin() + begin, tree.items.begin() + mid, tree.items.begin() + end,
+			[&boxes](unsigned int a, unsigned int b) { return boxes[a].minX + boxes[a].maxX < boxes[b].minX + boxes[b].maxX; });
+	}
+	else {
+		nth_element(tree.items.begin() + begin, tree.items.begin() + mid, tree.items.begin() + end,
+			[&boxes](unsigned int a, unsigned int b) { return boxes[a].minY + boxes[a].maxY < boxes[b].minY + boxes[b].maxY; });
+	}
+	// tree.nodes may reallocate while the children are built, so don't hold a reference
+	unsigned int left = buildRange(tree, boxes, begin, mid);
+	unsigned int right = buildRange(tree, boxes, mid, end);
+	tree.nodes[index].left = left;
+	tree.nodes[index].right = right;
+	return index;
+}
+
+double SpatialIndex::boxDistance2(const Box& box, double x, double y)
+{
+	double dx = x < box.minX ? box.minX - x : (x > box.maxX ? x - box.maxX : 0);
+	double dy = y < box.minY ? box.minY - y : (y > box.maxY ? y - box.maxY : 0);
+	return dx * dx + dy * dy;
+}
+
+double SpatialIndex::segmentDistance2(unsigned int s, double x, double y, double& fraction) const
+{
+	NodeId u = m_segmentFrom[s];
+	NodeId v = m_graph->edgeTarget(m_segmentEdge[s]);
+	double ax = m_x[u], ay = m_y[u];
+	double dx = m_x[v] - ax, dy = m_y[v] - ay;
+	double length2 = dx * dx + dy * dy;
+	fraction = length2 > 0 ? ((x - ax) * dx + (y - ay) * dy) / length2 : 0;
+	fraction = max(0.0, min(1.0, fraction));
+	double px = ax + fraction * dx - x;
+	double py = ay + fraction * dy - y;
+	return px * px + py * py;
+}
+
+template<typename ItemDistance>
+void SpatialIndex::search(const Tree& tree, unsigned int node, double x, double y, const ItemDistance& itemDistance2,
+	double& best, unsigned int& bestItem) const
+{
+	const TreeNode& t = tree.nodes[node];
+	if (t.left == NO_CHILD) {
+		for (unsigned int i = t.begin; i < t.end; ++i) {
+			double d = itemDistance2(tree.items[i]);
+			if (d <= best) {
+				best = d;
+				bestItem = tree.items[i];
+			}
+		}
+		return;
+	}
+	// Visit the nearer child first so the farther one is more likely to be pruned
+	double dl = boxDistance2(tree.nodes[t.left].box, x, y);
+	double dr = boxDistance2(tree.nodes[t.right].box, x, y);
+	unsigned int first = dl <= dr ? t.left : t.right;
+	unsigned int second = dl <= dr ? t.right : t.left;
+	if (min(dl, dr) <= best) {
+		search(tree, first, x, y, itemDistance2, best, bestItem);
+	}
+	if (max(dl, dr) <= best) {
+		search(tree, second, x, y, itemDistance2, best, bestItem);
+	}
+}
@@ -0,0 +1,78 @@
+#ifndef SI_H_
+#define SI_H_
+
+// SpatialIndex.h
+
+// Nearest-neighbor queries over a StreetGraph, for snapping coordinates that aren't
+// map vertices onto the map. Two static k-d trees are built: one over the nodes and
+// one over the street segments (each two-way pair of edges once). Every tree node
+// keeps the bounding box of everything below it, so a query only descends into
+// boxes that could hold something closer than the best match so far, which takes
+// O(log n) on a map like ours.
+// Distances are measured on a flat projection centered on the map's mean latitude.
+// Over a city-sized map that is within a tiny fraction of the great-circle distance,
+// and it makes "nearest point on a segment" a straight-line projection.
+
+#include "StreetGraph.h"
+#include <vector>
+
+class SpatialIndex
+{
+public:
+	typedef StreetGraph::NodeId NodeId;
+	typedef StreetGraph::EdgeId EdgeId;
+
+	SpatialIndex();
+	void build(const StreetGraph* graph);
+	void clear();
+	bool empty() const { return m_nodeTree.nodes.empty(); }
+
+	// Node closest to (lat, lon) that is at most radiusMiles away, or NO_NODE if there is none
+	NodeId nearestNode(double lat, double lon, double radiusMiles, double& distanceMiles) const;
+	// Closest point on any segment that is at most radiusMiles away. The segment is edge,
+	// leaving from, and the point is fraction of the way along it. False if there is none.
+	bool nearestSegmentPoint(double lat, double lon, double radiusMiles,
+		NodeId& from, EdgeId& edge, double& fraction, double& distanceMiles) const;
+
+	// We prevent a SpatialIndex object from being copied or assigned.
+	SpatialIndex(const SpatialIndex&) = delete;
+	SpatialIndex& operator=(const SpatialIndex&) = delete;
+
+private:
+	// Projected coordinates are degrees of latitude north and "degrees" east scaled by cos(mean latitude)
+	struct Box {
+		double minX, minY, maxX, maxY;
+	};
+	struct TreeNode {
+		Box box; // bounds of every item in items[begin, end)
+		unsigned int begin, end;
+		unsigned int left, right; // children, or NO_CHILD for a leaf
+	};
+	struct Tree {
+		std::vector<TreeNode> nodes; // nodes[0] is the root
+		std::vector<unsigned int> items; // item numbers, grouped so every tree node owns a range
+	};
+	enum { NO_CHILD = 0xFFFFFFFFu, LEAF_SIZE = 8 };
+
+	const StreetGraph* m_graph;
+	double m_xScale; // cos of the mean latitude
+	std::vector<double> m_x, m_y; // projected node positions
+	Tree m_nodeTree; // items are node IDs
+	Tree m_segmentTree; // items index m_segmentFrom / m_segmentEdge
+	std::vector<NodeId> m_segmentFrom;
+	std::vector<EdgeId> m_segmentEdge;
+
+	// Builds a tree over items 0 .. boxes.size() - 1 with the given bounding boxes
+	static void buildTree(Tree& tree, const std::vector<Box>& boxes);
+	static unsigned int buildRange(Tree& tree, const std::vector<Box>& boxes, unsigned int begin, unsigned int end);
+	// Squared distance from (x, y) to the nearest point of box
+	static double boxDistance2(const Box& box, double x, double y);
+	// Squared distance from (x, y) to segment s, and how far along it the nearest point is
+	double segmentDistance2(unsigned int s, double x, double y, double& fraction) const;
+	// Depth-first search for the item nearest (x, y), pruned by best (a squared distance)
+	template<typename ItemDistance>
+	void search(const Tree& tree, unsigned int node, double x, double y, const ItemDistance& itemDistance2,
+		double& best, unsigned int& bestItem) const;
+};
+
+#endif
@@ -0,0 +1,483 @@
+// StreetGraph.cpp
+
+#include "StreetGraph.h"
+#include "CrowDistance.h"
+#include <string>
+#include <vector>
+#include <functional>
+#include <fstream>
+#include <cstring>
+#include <cmath>
+using namespace std;
+
+namespace
+{
+	// Graph image layout. The header is followed by the sections below, each starting
+	// on an 8-byte boundary. Offsets are from the start of the image, and the checksum
+	// covers everything after the header. Bump IMAGE_VERSION whenever this changes.
+	const char IMAGE_MAGIC[8] = { 'G', 'O', 'O', 'B', 'M', 'A', 'P', '\0' };
+	const uint32_t IMAGE_VERSION = 3;
+	const uint32_t BYTE_ORDER_MARK = 0x01020304; // snapshots are only readable on hosts with the same byte order
+
+	enum Section {
+		LAT, LON, KEY, LAT_RAD, LON_RAD, COS_LAT, UNIT_X, UNIT_Y, UNIT_Z, COORD_TEXT_OFFSETS, COORD_TEXT, EDGE_OFFSETS, EDGE_TARGET, EDGE_LENGTH, EDGE_NAME,
+		NAME_OFFSETS, NAME_TEXT, INDEX, SECTION_COUNT
+	};
+
+	struct ImageHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t byteOrder;
+		uint32_t nodeCount;
+		uint32_t edgeCount;
+		uint32_t nameCount;
+		uint32_t indexSize; // slots in the lookup index, a power of two
+		uint64_t imageBytes;
+		uint64_t checksum;
+		uint64_t sectionOffset[SECTION_COUNT];
+		uint64_t sectionBytes[SECTION_COUNT];
+	};
+
+	// 64-bit FNV-1a over a block of bytes
+	uint64_t checksumBytes(const char* data, size_t bytes)
+	{
+		uint64_t h = 14695981039346656037ull;
+		for (size_t i = 0; i < bytes; ++i) {
+			h ^= (unsigned char)data[i];
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+	// Mixes a coordinate key into 32 bits (the 64-bit finalizer of MurmurHash3), used to place nodes in the lookup index
+	uint32_t keyHash(const CoordKey& key)
+	{
+		uint64_t h = (uint64_t)key.latitude * 0x9E3779B97F4A7C15ull ^ (uint64_t)key.longitude;
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDull;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ull;
+		h ^= h >> 33;
+		return (uint32_t)h;
+	}
+
+	size_t alignTo8(size_t n)
+	{
+		return (n + 7) & ~size_t(7);
+	}
+
+	// True if offsets[0 .. count] starts at 0, never decreases and ends at end
+	bool offsetsValid(const uint32_t* offsets, uint64_t count, uint64_t end)
+	{
+		if (offsets[0] != 0 || offsets[count] != end) {
+			return false;
+		}
+		for (uint64_t i = 0; i < count; ++i) {
+			if (offsets[i] > offsets[i + 1]) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// True if every one of the count IDs is below limit
+	bool idsBelow(const uint32_t* ids, uint64_t count, uint64_t limit)
+	{
+		for (uint64_t i = 0; i < count; ++i) {
+			if (ids[i] >= limit) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// The single empty slot used as the lookup index of an empty graph
+	const StreetGraph::NodeId EMPTY_INDEX[1] = { StreetGraph::NO_NODE };
+	const uint32_t ZERO_OFFSETS[1] = { 0 };
+}
+
+// Hash function for CoordKey key
+unsigned int hasher(const CoordKey& k)
+{
+	return keyHash(k);
+}
+
+// Hash function for street name key
+unsigned int hasher(const string& s)
+{
+	return std::hash<string>()(s);
+}
+
+const StreetGraph::NodeId StreetGraph::NO_NODE;
+
+StreetGraph::StreetGraph()
+{
+	unbind();
+}
+
+// Empties the graph, dropping any image or mapped snapshot
+void StreetGraph::clear()
+{
+	unbind();
+	vector<uint64_t>().swap(m_image);
+	m_mapped.close();
+	m_buildCoords.clear();
+	m_buildNames.clear();
+	m_nodeLookup.reset();
+	m_nameLookup.reset();
+	m_pending.clear();
+}
+
+// Gives gc the next node ID unless it already has one
+StreetGraph::NodeId StreetGraph::addNode(const GeoCoord& gc)
+{
+	// emplace hashes the key once both to find an existing ID and to add a new one
+	pair<NodeId*, bool> found = m_nodeLookup.emplace(CoordKey(gc.latitude, gc.longitude), (NodeId)m_buildCoords.size());
+	if (found.second) {
+		m_buildCoords.push_back(gc);
+	}
+	return *found.first;
+}
+
+StreetGraph::NodeId StreetGraph::addNode(const char* latitudeText, size_t latitudeLength, const char* longitudeText, size_t longitudeLength,
+	double latitude, double longitude)
+{
+	GeoCoord gc;
+	gc.latitudeText.assign(latitudeText, latitudeLength);
+	gc.longitudeText.assign(longitudeText, longitudeLength);
+	gc.latitude = latitude;
+	gc.longitude = longitude;
+	return addNode(gc);
+}
+
+// Gives name the next name ID unless it already has one
+StreetGraph::NameId StreetGraph::addName(const string& name)
+{
+	pair<NameId*, bool> found = m_nameLookup.emplace(name, (NameId)m_buildNames.size());
+	if (found.second) {
+		m_buildNames.push_back(name);
+	}
+	return *found.first;
+}
+
+// Edges are only buffered here; finalize() lays them out
+void StreetGraph::addEdge(NodeId from, NodeId to, NameId name)
+{
+	m_pending.push_back(PendingEdge{ from, to, name });
+}
+
+void StreetGraph::reserve(unsigned int nodes, unsigned int edges)
+{
+	m_buildCoords.reserve(nodes);
+	m_nodeLookup.reserve(nodes);
+	m_pending.reserve(edges);
+}
+
+// Builds every section of the image from the staged nodes, names and edges, then binds to it
+void StreetGraph::finalize()
+{
+	uint32_t nodes = (uint32_t)m_buildCoords.size();
+	uint32_t edges = (uint32_t)m_pending.size();
+	uint32_t names = (uint32_t)m_buildNames.size();
+
+	// Node positions, their keys, the trigonometry crow distances need, and their text
+	vector<CoordKey> key(nodes);
+	vector<double> lat(nodes), lon(nodes), latRad(nodes), lonRad(nodes), cosLat(nodes), unitX(nodes), unitY(nodes), unitZ(nodes);
+	vector<uint32_t> coordTextOffsets(2 * nodes + 1, 0);
+	string coordText;
+	for (uint32_t u = 0; u < nodes; ++u) {
+		const GeoCoord& gc = m_buildCoords[u];
+		lat[u] = gc.latitude;
+		lon[u] = gc.longitude;
+		key[u] = CoordKey(gc.latitude, gc.longitude);
+		latRad[u] = deg2rad(gc.latitude);
+		lonRad[u] = deg2rad(gc.longitude);
+		cosLat[u] = cos(latRad[u]);
+		unitVector(gc.latitude, gc.longitude, unitX[u], unitY[u], unitZ[u]);
+		coordText += gc.latitudeText;
+		coordTextOffsets[2 * u + 1] = (uint32_t)coordText.size();
+		coordText += gc.longitudeText;
+		coordTextOffsets[2 * u + 2] = (uint32_t)coordText.size();
+	}
+
+	// Counting sort of the pending edges by source node, keeping the order they were added in
+	vector<uint32_t> edgeOffsets(nodes + 1, 0);
+	for (size_t i = 0; i < m_pending.size(); ++i) {
+		++edgeOffsets[m_pending[i].from + 1];
+	}
+	for (uint32_t u = 0; u < nodes; ++u) {
+		edgeOffsets[u + 1] += edgeOffsets[u];
+	}
+	vector<NodeId> edgeTarget(edges);
+	vector<double> edgeLength(edges);
+	vector<NameId> edgeName(edges);
+	vector<EdgeId> next(edgeOffsets.begin(), edgeOffsets.end() - 1);
+	for (size_t i = 0; i < m_pending.size(); ++i) {
+		const PendingEdge& pe = m_pending[i];
+		EdgeId e = next[pe.from]++;
+		edgeTarget[e] = pe.to;
+		edgeLength[e] = ::crowMiles(latRad[pe.from], lonRad[pe.from], cosLat[pe.from], latRad[pe.to], lonRad[pe.to], cosLat[pe.to]);
+		edgeName[e] = pe.name;
+	}
+
+	// Street name table
+	vector<uint32_t> nameOffsets(names + 1, 0);
+	string nameText;
+	for (uint32_t i = 0; i < names; ++i) {
+		nameText += m_buildNames[i];
+		nameOffsets[i + 1] = (uint32_t)nameText.size();
+	}
+
+	// Lookup index: linear probing in a power-of-two table at most half full
+	uint32_t indexSize = 1;
+	while (indexSize < 2 * nodes) {
+		indexSize *= 2;
+	}
+	vector<NodeId> index(indexSize, NO_NODE);
+	for (uint32_t u = 0; u < nodes; ++u) {
+		uint32_t slot = keyHash(key[u]) & (indexSize - 1);
+		while (index[slot] != NO_NODE) {
+			slot = (slot + 1) & (indexSize - 1);
+		}
+		index[slot] = u;
+	}
+
+	// Lay the sections out after the header
+	const void* sectionData[SECTION_COUNT] = {
+		lat.data(), lon.data(), key.data(), latRad.data(), lonRad.data(), cosLat.data(), unitX.data(), unitY.data(), unitZ.data(),
+		coordTextOffsets.data(), coordText.data(), edgeOffsets.data(),
+		edgeTarget.data(), edgeLength.data(), edgeName.data(), nameOffsets.data(), nameText.data(), index.data()
+	};
+	ImageHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+	header.version = IMAGE_VERSION;
+	header.byteOrder = BYTE_ORDER_MARK;
+	header.nodeCount = nodes;
+	header.edgeCount = edges;
+	header.nameCount = names;
+	header.indexSize = indexSize;
+	header.sectionBytes[LAT] = lat.size() * sizeof(double);
+	header.sectionBytes[LON] = lon.size() * sizeof(double);
+	header.sectionBytes[KEY] = key.size() * sizeof(CoordKey);
+	header.sectionBytes[LAT_RAD] = latRad.size() * sizeof(double);
+	header.sectionBytes[LON_RAD] = lonRad.size() * sizeof(double);
+	header.sectionBytes[COS_LAT] = cosLat.size() * sizeof(double);
+	header.sectionBytes[UNIT_X] = unitX.size() * sizeof(double);
+	header.sectionBytes[UNIT_Y] = unitY.size() * sizeof(double);
+	header.sectionBytes[UNIT_Z] = unitZ.size() * sizeof(double);
+	header.sectionBytes[COORD_TEXT_OFFSETS] = coordTextOffsets.size() * sizeof(uint32_t);
+	header.sectionBytes[COORD_TEXT] = coordText.size();
+	header.sectionBytes[EDGE_OFFSETS] = edgeOffsets.size() * sizeof(uint32_t);
+	header.sectionBytes[EDGE_TARGET] = edgeTarget.size() * sizeof(NodeId);
+	header.sectionBytes[EDGE_LENGTH] = edgeLength.size() * sizeof(double);
+	header.sectionBytes[EDGE_NAME] = edgeName.size() * sizeof(NameId);
+	header.sectionBytes[NAME_OFFSETS] = nameOffsets.size() * sizeof(uint32_t);
+	header.sectionBytes[NAME_TEXT] = nameText.size();
+	header.sectionBytes[INDEX] = index.size() * sizeof(NodeId);
+	size_t bytes = alignTo8(sizeof(ImageHeader));
+	for (int s = 0; s < SECTION_COUNT; ++s) {
+		header.sectionOffset[s] = bytes;
+		bytes = alignTo8(bytes + (size_t)header.sectionBytes[s]);
+	}
+	header.imageBytes = bytes;
+
+	// Copy everything into one 8-byte aligned buffer (zeroed, so padding is deterministic)
+	vector<uint64_t> image(bytes / 8, 0);
+	char* base = reinterpret_cast<char*>(image.data());
+	for (int s = 0; s < SECTION_COUNT; ++s) {
+		if (header.sectionBytes[s] > 0) {
+			memcpy(base + header.sectionOffset[s], sectionData[s], (size_t)header.sectionBytes[s]);
+		}
+	}
+	size_t headerBytes = alignTo8(sizeof(ImageHeader));
+	header.checksum = checksumBytes(base + headerBytes, bytes - headerBytes);
+	memcpy(base, &header, sizeof(header));
+
+	// Swap in the new image and drop the staging data
+	unbind();
+	m_mapped.close();
+	m_image.swap(image);
+	bind(reinterpret_cast<const char*>(m_image.data()), bytes);
+	vector<GeoCoord>().swap(m_buildCoords);
+	vector<string>().swap(m_buildNames);
+	vector<PendingEdge>().swap(m_pending);
+	m_nodeLookup.reset();
+	m_nameLookup.reset();
+}
+
+// Writes the current image to file unchanged
+bool StreetGraph::saveSnapshot(const string& file) const
+{
+	ofstream outfile(file, ios::binary | ios::trunc);
+	if (!outfile) {
+		cerr << "Error: Cannot create " << file << "!" << endl;
+		return false;
+	}
+	outfile.write(m_imageData, m_imageBytes);
+	if (!outfile) {
+		cerr << "Error: Cannot write " << file << "!" << endl;
+		return false;
+	}
+	return true;
+}
+
+// Maps file and uses it as the image if it checks out
+bool StreetGraph::loadSnapshot(const string& file)
+{
+	clear();
+	if (!m_mapped.open(file)) {
+		cerr << "Error: Cannot open " << file << "!" << endl;
+		return false;
+	}
+	if (!bind(m_mapped.data(), m_mapped.size())) {
+		cerr << "Error: " << file << " is not a valid map snapshot!" << endl;
+		clear();
+		return false;
+	}
+	return true;
+}
+
+// Checks the header, section bounds and checksum of an image and points the views into it
+bool StreetGraph::bind(const char* image, size_t bytes)
+{
+	unbind();
+	size_t headerBytes = alignTo8(sizeof(ImageHeader));
+	if (bytes < headerBytes) {
+		return false;
+	}
+	ImageHeader header;
+	memcpy(&header, image, sizeof(header));
+	if (memcmp(header.magic, IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0 || header.version != IMAGE_VERSION
+		|| header.byteOrder != BYTE_ORDER_MARK || header.imageBytes != bytes) {
+		return false;
+	}
+
+	// Every section has to be aligned, inside the image and exactly as big as the counts say.
+	// The index needs at least one empty slot, or probing for a missing key would never stop.
+	uint64_t n = header.nodeCount, e = header.edgeCount, m = header.nameCount;
+	if (header.indexSize == 0 || (header.indexSize & (header.indexSize - 1)) != 0 || header.indexSize <= n) {
+		return false;
+	}
+	uint64_t expected[SECTION_COUNT] = {
+		n * sizeof(double), n * sizeof(double), n * sizeof(CoordKey), n * sizeof(double), n * sizeof(double),
+		n * sizeof(double), n * sizeof(double), n * sizeof(double), n * sizeof(double), (2 * n + 1) * sizeof(uint32_t), header.sectionBytes[COORD_TEXT],
+		(n + 1) * sizeof(uint32_t), e * sizeof(NodeId), e * sizeof(double), e * sizeof(NameId),
+		(m + 1) * sizeof(uint32_t), header.sectionBytes[NAME_TEXT], header.indexSize * (uint64_t)sizeof(NodeId)
+	};
+	for (int s = 0; s < SECTION_COUNT; ++s) {
+		if (header.sectionBytes[s] != expected[s] || header.sectionOffset[s] % 8 != 0
+			|| header.sectionOffset[s] < headerBytes || header.sectionOffset[s] > bytes
+			|| header.sectionBytes[s] > bytes - header.sectionOffset[s]) {
+			return false;
+		}
+	}
+	if (checksumBytes(image + headerBytes, bytes - headerBytes) != header.checksum) {
+		return false;
+	}
+
+	// A checksum only catches accidents, so everything used as an array index is checked too:
+	// the offset tables have to run in order up to the end of their data, edges have to point
+	// at existing nodes and names, and index slots have to be empty or hold a node
+	const uint32_t* coordTextOffsets = reinterpret_cast<const uint32_t*>(image + header.sectionOffset[COORD_TEXT_OFFSETS]);
+	const uint32_t* edgeOffsets = reinterpret_cast<const uint32_t*>(image + header.sectionOffset[EDGE_OFFSETS]);
+	const uint32_t* nameOffsets = reinterpret_cast<const uint32_t*>(image + header.sectionOffset[NAME_OFFSETS]);
+	const NodeId* edgeTarget = reinterpret_cast<const NodeId*>(image + header.sectionOffset[EDGE_TARGET]);
+	const NameId* edgeName = reinterpret_cast<const NameId*>(image + header.sectionOffset[EDGE_NAME]);
+	const NodeId* index = reinterpret_cast<const NodeId*>(image + header.sectionOffset[INDEX]);
+	if (!offsetsValid(coordTextOffsets, 2 * n, header.sectionBytes[COORD_TEXT]) || !offsetsValid(edgeOffsets, n, e)
+		|| !offsetsValid(nameOffsets, m, header.sectionBytes[NAME_TEXT]) || !idsBelow(edgeTarget, e, n) || !idsBelow(edgeName, e, m)) {
+		return false;
+	}
+	uint64_t filled = 0;
+	for (uint32_t slot = 0; slot < header.indexSize; ++slot) {
+		if (index[slot] != NO_NODE) {
+			if (index[slot] >= n) {
+				return false;
+			}
+			++filled;
+		}
+	}
+	if (filled > n) {
+		return false;
+	}
+
+	m_nodeCount = header.nodeCount;
+	m_edgeCount = header.edgeCount;
+	m_nameCount = header.nameCount;
+	m_indexMask = header.indexSize - 1;
+	m_lat = reinterpret_cast<const double*>(image + header.sectionOffset[LAT]);
+	m_lon = reinterpret_cast<const double*>(image + header.sectionOffset[LON]);
+	m_key = reinterpret_cast<const CoordKey*>(image + header.sectionOffset[KEY]);
+	m_latRad = reinterpret_cast<const double*>(image + header.sectionOffset[LAT_RAD]);
+	m_lonRad = reinterpret_cast<const double*>(image + header.sectionOffset[LON_RAD]);
+	m_cosLat = reinterpret_cast<const double*>(image + header.sectionOffset[COS_LAT]);
+	m_unitX = reinterpret_cast<const double*>(image + header.sectionOffset[UNIT_X]);
+	m_unitY = reinterpret_cast<const double*>(image + header.sectionOffset[UNIT_Y]);
+	m_unitZ = reinterpret_cast<const double*>(image + header.sectionOffset[UNIT_Z]);
+	m_coordTextOffsets = coordTextOffsets;
+	m_coordText = image + header.sectionOffset[COORD_TEXT];
+	m_edgeOffsets = edgeOffsets;
+	m_edgeTarget = edgeTarget;
+	m_edgeLength = reinterpret_cast<const double*>(image + header.sectionOffset[EDGE_LENGTH]);
+	m_edgeName = edgeName;
+	m_nameOffsets = nameOffsets;
+	m_nameText = image + header.sectionOffset[NAME_TEXT];
+	m_index = index;
+	m_imageData = image;
+	m_imageBytes = bytes;
+	m_checksum = header.checksum;
+	return true;
+}
+
+// An empty graph still has valid offset tables and a one-slot index
+void StreetGraph::unbind()
+{
+	m_nodeCount = m_edgeCount = m_nameCount = 0;
+	m_indexMask = 0;
+	m_lat = m_lon = m_edgeLength = nullptr;
+	m_key = nullptr;
+	m_latRad = m_lonRad = m_cosLat = m_unitX = m_unitY = m_unitZ = nullptr;
+	m_coordTextOffsets = m_edgeOffsets = m_nameOffsets = ZERO_OFFSETS;
+	m_coordText = m_nameText = "";
+	m_edgeTarget = m_edgeName = nullptr;
+	m_index = EMPTY_INDEX;
+	m_imageData = nullptr;
+	m_imageBytes = 0;
+	m_checksum = 0;
+}
+
+// Probes the lookup index, comparing keys
+StreetGraph::NodeId StreetGraph::findNode(const CoordKey& key) const
+{
+	uint32_t slot = keyHash(key) & m_indexMask;
+	for (NodeId u = m_index[slot]; u != NO_NODE; u = m_index[slot]) {
+		if (m_key[u] == key) {
+			return u;
+		}
+		slot = (slot + 1) & m_indexMask;
+	}
+	return NO_NODE;
+}
+
+// Rebuilds the GeoCoord without reparsing the numbers
+GeoCoord StreetGraph::coord(NodeId u) const
+{
+	const uint32_t* off = m_coordTextOffsets + 2 * u;
+	GeoCoord gc;
+	gc.latitudeText.assign(m_coordText + off[0], off[1] - off[0]);
+	gc.longitudeText.assign(m_coordText + off[1], off[2] - off[1]);
+	gc.latitude = m_lat[u];
+	gc.longitude = m_lon[u];
+	return gc;
+}
+
+string StreetGraph::streetName(NameId id) const
+{
+	return string(m_nameText + m_nameOffsets[id], m_nameOffsets[id + 1] - m_nameOffsets[id]);
+}
+
+StreetSegment StreetGraph::segment(NodeId from, EdgeId e) const
+{
+	return StreetSegment(coord(from), coord(m_edgeTarget[e]), streetName(m_edgeName[e]));
+}
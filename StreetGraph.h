@@ -0,0 +1,198 @@
+#ifndef SG_H_
+#define SG_H_
+
+// StreetGraph.h
+
+// Compressed-sparse-row (CSR) road graph built by StreetMap::load.
+// Every map vertex gets a dense node ID from 0 to nodeCount() - 1, and the edges
+// leaving node u are the IDs edgeBegin(u) up to (not including) edgeEnd(u).
+// Edge data (target, length in miles, street name ID) lives in contiguous arrays,
+// so walking a node's neighbors touches a few adjacent cache lines instead of a
+// heap-allocated vector of StreetSegments. GeoCoords are only needed at the API
+// boundary: findNode() turns one into a node ID by its CoordKey and segment() turns
+// an edge back into a StreetSegment. Coordinate text is only built for output.
+//
+// All of the arrays, the street name table and the CoordKey lookup index are
+// packed into one flat, pointer-free image. finalize() builds the image in memory;
+// saveSnapshot() writes it to disk unchanged and loadSnapshot() maps such a file
+// and uses it in place, so a snapshot needs no parsing at all.
+
+#include "provided.h"
+#include "RobinHoodHashMap.h"
+#include "MappedFile.h"
+#include "CrowDistance.h"
+#include "CoordKey.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// A street segment as the map stores it, for StreetMap::visitSegmentsThatStartWith. Nothing
+// in it is copied out of the map: the ends are node IDs of StreetMap::graph(), the street is
+// one of its name IDs, and the length was worked out when the map was loaded.
+struct StreetEdgeRef
+{
+	unsigned int start; // node IDs
+	unsigned int end;
+	unsigned int edge; // edge ID, for StreetGraph::segment
+	unsigned int name; // street name ID, for StreetGraph::streetName
+	double miles;
+};
+
+class StreetGraph
+{
+public:
+	typedef unsigned int NodeId;
+	typedef unsigned int EdgeId;
+	typedef unsigned int NameId;
+	// Returned by findNode when a GeoCoord isn't a vertex of the map
+	static const NodeId NO_NODE = 0xFFFFFFFFu;
+
+	StreetGraph();
+	void clear(); // removes every node, edge and street name
+
+	// Building: add nodes, names and edges in any order, then call finalize() once
+	NodeId addNode(const GeoCoord& gc); // returns the existing ID if gc was already added
+	// The same from a coordinate's text and the numbers already read from it, which skips parsing them again
+	NodeId addNode(const char* latitudeText, size_t latitudeLength, const char* longitudeText, size_t longitudeLength,
+		double latitude, double longitude);
+	NameId addName(const std::string& name); // interns name, returning the existing ID if present
+	void addEdge(NodeId from, NodeId to, NameId name); // edges keep the order they were added in
+	void reserve(unsigned int nodes, unsigned int edges); // makes room for about that many, so adding doesn't keep regrowing
+	void finalize(); // packs everything added into the graph image and computes edge lengths
+
+	// Snapshots: the graph image written to / mapped from a file
+	bool saveSnapshot(const std::string& file) const;
+	bool loadSnapshot(const std::string& file); // on failure the graph is left empty
+
+	// Sizes
+	unsigned int nodeCount() const { return m_nodeCount; }
+	unsigned int edgeCount() const { return m_edgeCount; }
+	unsigned int nameCount() const { return m_nameCount; }
+	// Checksum of the graph image; identical maps have identical checksums
+	uint64_t checksum() const { return m_checksum; }
+
+	// Returns the node ID for gc, or NO_NODE if gc isn't a vertex of the map; only gc's
+	// position counts, to 1e-7 degree, not how its text is written
+	NodeId findNode(const GeoCoord& gc) const { return findNode(CoordKey(gc.latitude, gc.longitude)); }
+	NodeId findNode(const CoordKey& key) const;
+
+	// One edge read in place from the edge arrays
+	struct EdgeView {
+		EdgeId id;
+		NodeId target;
+		double length;
+		NameId name;
+	};
+	// The edges leaving one node, for range-based for loops; nothing is copied out of the
+	// graph but the few numbers of the edge being visited
+	class EdgeRange
+	{
+	public:
+		class iterator
+		{
+		public:
+			iterator(const StreetGraph* graph, EdgeId e) : m_graph(graph), m_edge(e) {}
+			EdgeView operator*() const
+			{
+				EdgeView view = { m_edge, m_graph->m_edgeTarget[m_edge], m_graph->m_edgeLength[m_edge], m_graph->m_edgeName[m_edge] };
+				return view;
+			}
+			iterator& operator++() { ++m_edge; return *this; }
+			bool operator==(const iterator& other) const { return m_edge == other.m_edge; }
+			bool operator!=(const iterator& other) const { return m_edge != other.m_edge; }
+		private:
+			const StreetGraph* m_graph;
+			EdgeId m_edge;
+		};
+		EdgeRange(const StreetGraph* graph, EdgeId begin, EdgeId end) : m_graph(graph), m_begin(begin), m_end(end) {}
+		iterator begin() const { return iterator(m_graph, m_begin); }
+		iterator end() const { return iterator(m_graph, m_end); }
+		unsigned int size() const { return m_end - m_begin; }
+	private:
+		const StreetGraph* m_graph;
+		EdgeId m_begin, m_end;
+	};
+	EdgeRange edges(NodeId u) const { return EdgeRange(this, m_edgeOffsets[u], m_edgeOffsets[u + 1]); }
+
+	// Edges leaving u are edgeBegin(u) .. edgeEnd(u) - 1
+	EdgeId edgeBegin(NodeId u) const { return m_edgeOffsets[u]; }
+	EdgeId edgeEnd(NodeId u) const { return m_edgeOffsets[u + 1]; }
+	NodeId edgeTarget(EdgeId e) const { return m_edgeTarget[e]; }
+	double edgeLength(EdgeId e) const { return m_edgeLength[e]; }
+	NameId edgeName(EdgeId e) const { return m_edgeName[e]; }
+
+	// Node positions in degrees, and as keys
+	double latitude(NodeId u) const { return m_lat[u]; }
+	const CoordKey& key(NodeId u) const { return m_key[u]; }
+	double longitude(NodeId u) const { return m_lon[u]; }
+	// Crow-flies distance in miles between two nodes, the same as distanceEarthMiles gives, from
+	// radians and cos(latitude) stored with the graph
+	double crowMiles(NodeId u, NodeId v) const
+	{
+		return ::crowMiles(m_latRad[u], m_lonRad[u], m_cosLat[u], m_latRad[v], m_lonRad[v], m_cosLat[v]);
+	}
+	// A lower bound on crowMiles that needs no trigonometry (see chordMiles in CrowDistance.h)
+	double crowBound(NodeId u, NodeId v) const
+	{
+		return chordMiles(m_unitX[u], m_unitY[u], m_unitZ[u], m_unitX[v], m_unitY[v], m_unitZ[v]);
+	}
+
+	// Text forms are only materialized on request
+	GeoCoord coord(NodeId u) const;
+	std::string streetName(NameId id) const;
+	// Materializes edge e (which must leave node from) as a StreetSegment
+	StreetSegment segment(NodeId from, EdgeId e) const;
+
+	// We prevent a StreetGraph object from being copied or assigned.
+	StreetGraph(const StreetGraph&) = delete;
+	StreetGraph& operator=(const StreetGraph&) = delete;
+
+private:
+	// Views into the current image (m_image or m_mapped)
+	unsigned int m_nodeCount, m_edgeCount, m_nameCount, m_indexMask;
+	const double* m_lat; // indexed by NodeId
+	const double* m_lon;
+	const CoordKey* m_key;
+	const double* m_latRad; // the same in radians
+	const double* m_lonRad;
+	const double* m_cosLat;
+	const double* m_unitX; // position on the unit sphere
+	const double* m_unitY;
+	const double* m_unitZ;
+	const uint32_t* m_coordTextOffsets; // node u's text is [2u, 2u + 1) then [2u + 1, 2u + 2)
+	const char* m_coordText;
+	const uint32_t* m_edgeOffsets; // m_edgeOffsets[u] is the first edge of node u
+	const NodeId* m_edgeTarget; // indexed by EdgeId
+	const double* m_edgeLength;
+	const NameId* m_edgeName;
+	const uint32_t* m_nameOffsets; // name i is [i, i + 1)
+	const char* m_nameText;
+	const NodeId* m_index; // open-addressed CoordKey lookup, NO_NODE for empty slots
+
+	// The whole current image
+	const char* m_imageData;
+	size_t m_imageBytes;
+	uint64_t m_checksum;
+	// Storage backing the views: either an image built by finalize() or a mapped snapshot
+	std::vector<uint64_t> m_image;
+	MappedFile m_mapped;
+
+	// Points the views at a complete image, checking it first
+	bool bind(const char* image, size_t bytes);
+	// Views of an empty graph
+	void unbind();
+
+	// Staging data only used while building
+	std::vector<GeoCoord> m_buildCoords;
+	std::vector<std::string> m_buildNames;
+	RobinHoodHashMap<CoordKey, NodeId> m_nodeLookup;
+	RobinHoodHashMap<std::string, NameId> m_nameLookup;
+	struct PendingEdge {
+		NodeId from;
+		NodeId to;
+		NameId name;
+	};
+	std::vector<PendingEdge> m_pending;
+};
+
+#endif
@@ -4,120 +4,238 @@
 #include "provided.h"
 #include <string>
 #include <list>
-#include <functional>
 #include <fstream>
-#include "ExpandableHashMap.h"
+#include <iterator>
+#include <chrono>
+#include "StreetGraph.h"
+#include "MapParser.h"
+#include "MappedFile.h"
+#include "ContractionHierarchy.h"
+#include "LandmarkTable.h"
+#include "RouteCache.h"
+#include "SpatialIndex.h"
 using namespace std;
 
-// Hash function for GeoCoord key
-unsigned int hasher(const GeoCoord& g)
-{
-	return std::hash<string>()(g.latitudeText + g.longitudeText);
-}
-
 // StreetMap implementation
 class StreetMapImpl
 {
 public:
-	StreetMapImpl(); // Construct and
-	~StreetMapImpl(); // destruct m_map
+	StreetMapImpl();
+	~StreetMapImpl();
 	bool load(string mapFile); // Load all data from indicated file
+	MapLoadStats lastLoadStats() const { return m_loadStats; }
+	// Use m_graph to get all street segments from that point
 	bool getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const; 
-	// Use m_map to get value for key (all street segments from that point)
+	bool visitSegmentsThatStartWith(const GeoCoord& gc, const function<void(const StreetEdgeRef&)>& visit) const;
+	bool saveSnapshot(string snapshotFile) const { return m_graph.saveSnapshot(snapshotFile); }
+	bool loadSnapshot(string snapshotFile);
+	const StreetGraph* graph() const { return &m_graph; }
+	// Contraction hierarchy over m_graph, built on request
+	void buildContractionHierarchy() { m_ch.build(&m_graph); }
+	const ContractionHierarchy* contractionHierarchy() const { return m_ch.empty() ? nullptr : &m_ch; }
+	// Landmark tables over m_graph, built or loaded on request
+	void buildLandmarks(unsigned int count, LandmarkStrategy strategy) { m_landmarks.build(&m_graph, count, strategy); }
+	bool saveLandmarks(string landmarkFile) const { return m_landmarks.save(landmarkFile); }
+	bool loadLandmarks(string landmarkFile) { return m_landmarks.load(landmarkFile, &m_graph); }
+	const LandmarkTable* landmarks() const { return m_landmarks.empty() ? nullptr : &m_landmarks; }
+	RouteCache* routeCache() const { return &m_routeCache; }
+	// Nearest vertex / point on a segment, using m_spatial
+	bool nearestNode(const GeoCoord& gc, double radiusMiles, GeoCoord& node) const;
+	bool nearestPointOnSegment(const GeoCoord& gc, double radiusMiles, GeoCoord& point, StreetSegment& segment) const;
+	const SpatialIndex* spatialIndex() const { return &m_spatial; }
 private:
-	// m_map will hold all GeoCoords and the street segments connected to it
-	ExpandableHashMap<GeoCoord, vector<StreetSegment>>* m_map;
+	// m_graph holds every GeoCoord as a node and every street segment (both directions) as an edge
+	StreetGraph m_graph;
+	// m_ch is empty until buildContractionHierarchy is called for the current graph
+	ContractionHierarchy m_ch;
+	// m_landmarks is empty until buildLandmarks or loadLandmarks is called for the current graph
+	LandmarkTable m_landmarks;
+	// m_routeCache is thread-safe, so routers on a const StreetMap can all fill it
+	mutable RouteCache m_routeCache;
+	// m_spatial is rebuilt for every graph loaded
+	SpatialIndex m_spatial;
+	MapLoadStats m_loadStats;
 };
 
-// Initialize m_map
-StreetMapImpl::StreetMapImpl(): m_map(new ExpandableHashMap<GeoCoord, vector<StreetSegment>>)
+StreetMapImpl::StreetMapImpl()
 {
 }
 
-// Delete m_map and all StreetSegment pointers of m_segmentsList
 StreetMapImpl::~StreetMapImpl()
 {
-	delete m_map;
 }
 
-// Read data from mapFile
+// Read data from mapFile: the whole file is mapped (or read in one go if it can't be), MapParser
+// parses its stanzas in parallel, and then the parsed segments are added to the graph in file order
 bool StreetMapImpl::load(string mapFile)
 {
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
 	// Try to read mapFile...
-	ifstream infile(mapFile);
-	// If it's invalid...
-	if (!infile) {
-		cerr << "Error: Cannot open mapdata.txt!" << endl;
-		return false;
+	MappedFile mapped;
+	string buffered;
+	const char* text;
+	size_t bytes;
+	if (mapped.open(mapFile)) {
+		text = mapped.data();
+		bytes = mapped.size();
+	}
+	else {
+		// Empty files can't be mapped
+		ifstream infile(mapFile, ios::binary);
+		// If it's invalid...
+		if (!infile) {
+			cerr << "Error: Cannot open mapdata.txt!" << endl;
+			return false;
+		}
+		buffered.assign(istreambuf_iterator<char>(infile), istreambuf_iterator<char>());
+		text = buffered.data();
+		bytes = buffered.size();
 	}
+	MapParser parser;
+	parser.parse(text, bytes);
+	chrono::steady_clock::time_point parsed = chrono::steady_clock::now();
+
+	// Start from an empty graph in case something was loaded before
+	m_graph.clear();
+	m_ch.clear();
+	m_landmarks.clear();
+	m_routeCache.clear();
+	m_spatial.clear();
 	
-	// Otherwise, for each street in the file...
-	string street;
-	// Read street names until you reach the end of the file
-	while (getline(infile, street)) {
-		// Get the number of segments for the street
-		int segNum;
-		infile >> segNum;
-		infile.ignore(10000, '\n');
-
-		// For each segment
-		for (int i = 0; i < segNum; ++i) {
-			// Get the line with the start and end coordinates
-			string line;
-			getline(infile, line);
-			istringstream iss(line);
-			string lat1, long1, lat2, long2;
-
-			// If it isn't two coordinates...
-			if (!(iss >> lat1 >> long1 >> lat2 >> long2)) {
-				cerr << "Ignoring badly-formatted street segment line: " << line << endl;
-				continue;
-			}
-
-			// Otherwise...
-			GeoCoord start(lat1, long1);
-			GeoCoord end(lat2, long2);
-
-			// Insert a street segment from the start to the end coordinate into the map
-			vector<StreetSegment>* segmentsPtr = m_map->find(start);
-			StreetSegment segment(start, end, street);
-			if (segmentsPtr != nullptr) {
-				segmentsPtr->push_back(segment);
-			}
-			else {
-				vector<StreetSegment> segments;
-				segments.push_back(segment);
-				m_map->associate(start, segments);
-			}
-
-			// Insert a street segment from the end to the start coordiante into the map
-			segmentsPtr = m_map->find(end);
-			StreetSegment reverseSegment(end, start, street);
-			if (segmentsPtr != nullptr) {
-				segmentsPtr->push_back(reverseSegment);
-			}
-			else {
-				vector<StreetSegment> segments;
-				segments.push_back(reverseSegment);
-				m_map->associate(end, segments);
-			}
+	// A street of n segments usually has n + 1 points
+	const vector<MapParser::Text>& streets = parser.streets();
+	const vector<MapParser::Segment>& segments = parser.segments();
+	m_graph.reserve((unsigned int)(segments.size() + streets.size()), 2 * (unsigned int)segments.size());
+
+	// Name IDs follow the order of the streets in the file
+	vector<StreetGraph::NameId> names(streets.size());
+	for (size_t i = 0; i < streets.size(); ++i) {
+		names[i] = m_graph.addName(string(streets[i].data, streets[i].size));
+	}
+
+	// For each segment
+	int added = 0;
+	for (size_t i = 0; i < segments.size(); ++i) {
+		const MapParser::Segment& seg = segments[i];
+		// If it isn't two coordinates (that a CoordKey can hold)...
+		if (!seg.valid || !CoordKey(seg.start.latitude, seg.start.longitude).valid() || !CoordKey(seg.end.latitude, seg.end.longitude).valid()) {
+			cerr << "Ignoring badly-formatted street segment line: " << string(seg.line.data, seg.line.size) << endl;
+			continue;
 		}
+
+		// Otherwise...
+		StreetGraph::NodeId start = m_graph.addNode(seg.start.latitudeText.data, seg.start.latitudeText.size,
+			seg.start.longitudeText.data, seg.start.longitudeText.size, seg.start.latitude, seg.start.longitude);
+		StreetGraph::NodeId end = m_graph.addNode(seg.end.latitudeText.data, seg.end.latitudeText.size,
+			seg.end.longitudeText.data, seg.end.longitudeText.size, seg.end.latitude, seg.end.longitude);
+
+		// Insert a street segment from the start to the end coordinate and from the end to the start
+		m_graph.addEdge(start, end, names[seg.street]);
+		m_graph.addEdge(end, start, names[seg.street]);
+		++added;
+	}
+	// Pack the edges into their final arrays
+	m_graph.finalize();
+	m_spatial.build(&m_graph);
+
+	chrono::steady_clock::time_point done = chrono::steady_clock::now();
+	m_loadStats = MapLoadStats();
+	m_loadStats.bytes = bytes;
+	m_loadStats.streets = (int)streets.size();
+	m_loadStats.segments = added;
+	m_loadStats.chunks = parser.chunks();
+	m_loadStats.parseMilliseconds = chrono::duration<double, milli>(parsed - start).count();
+	m_loadStats.milliseconds = chrono::duration<double, milli>(done - start).count();
+	if (m_loadStats.milliseconds > 0) {
+		m_loadStats.megabytesPerSecond = bytes / 1e6 / (m_loadStats.milliseconds / 1000);
 	}
 	// If everything succeeded, return true
 	return true;
 }
 
+// Maps a snapshot written by saveSnapshot; any hierarchy, landmarks or cached routes belonged to the old graph
+bool StreetMapImpl::loadSnapshot(string snapshotFile)
+{
+	m_ch.clear();
+	m_landmarks.clear();
+	m_routeCache.clear();
+	m_spatial.clear();
+	if (!m_graph.loadSnapshot(snapshotFile)) {
+		return false;
+	}
+	m_spatial.build(&m_graph);
+	return true;
+}
+
 // Retrieves all StreetSegments (reversed too) whose start location matches gc, puts them in segs
 bool StreetMapImpl::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
-	// Get the pointer
-	vector<StreetSegment>* segmentsPtr = m_map->find(gc);
+	// Get the node
+	StreetGraph::NodeId u = m_graph.findNode(gc);
 
-	// If it's nullptr, the gc is invalid for this map
-	if (segmentsPtr == nullptr)
+	// If there isn't one, the gc is invalid for this map
+	if (u == StreetGraph::NO_NODE)
 		return false; 
 	// Otherwise...
-	segs = *segmentsPtr;
+	segs.clear();
+	segs.reserve(m_graph.edges(u).size());
+	for (StreetGraph::EdgeView edge : m_graph.edges(u)) {
+		segs.push_back(m_graph.segment(u, edge.id));
+	}
+	return true;
+}
+
+// Hands out the stored edges themselves
+bool StreetMapImpl::visitSegmentsThatStartWith(const GeoCoord& gc, const function<void(const StreetEdgeRef&)>& visit) const
+{
+	StreetGraph::NodeId u = m_graph.findNode(gc);
+	if (u == StreetGraph::NO_NODE) {
+		return false;
+	}
+	for (StreetGraph::EdgeView edge : m_graph.edges(u)) {
+		StreetEdgeRef ref = { u, edge.target, edge.id, edge.name, edge.length };
+		visit(ref);
+	}
+	return true;
+}
+
+bool StreetMapImpl::nearestNode(const GeoCoord& gc, double radiusMiles, GeoCoord& node) const
+{
+	double distance;
+	StreetGraph::NodeId u = m_spatial.nearestNode(gc.latitude, gc.longitude, radiusMiles, distance);
+	if (u == StreetGraph::NO_NODE) {
+		return false;
+	}
+	node = m_graph.coord(u);
+	return true;
+}
+
+bool StreetMapImpl::nearestPointOnSegment(const GeoCoord& gc, double radiusMiles, GeoCoord& point, StreetSegment& segment) const
+{
+	StreetGraph::NodeId from;
+	StreetGraph::EdgeId edge;
+	double fraction, distance;
+	if (!m_spatial.nearestSegmentPoint(gc.latitude, gc.longitude, radiusMiles, from, edge, fraction, distance)) {
+		return false;
+	}
+	segment = m_graph.segment(from, edge);
+	// At either end, use the vertex itself so the point stays routable
+	if (fraction <= 0) {
+		point = segment.start;
+	}
+	else if (fraction >= 1) {
+		point = segment.end;
+	}
+	else {
+		ostringstream lat, lon;
+		lat.setf(ios::fixed);
+		lon.setf(ios::fixed);
+		lat.precision(7);
+		lon.precision(7);
+		lat << segment.start.latitude + fraction * (segment.end.latitude - segment.start.latitude);
+		lon << segment.start.longitude + fraction * (segment.end.longitude - segment.start.longitude);
+		point = GeoCoord(lat.str(), lon.str());
+	}
 	return true;
 }
 
@@ -141,7 +259,87 @@ bool StreetMap::load(string mapFile)
 	return m_impl->load(mapFile);
 }
 
+MapLoadStats StreetMap::lastLoadStats() const
+{
+	return m_impl->lastLoadStats();
+}
+
 bool StreetMap::getSegmentsThatStartWith(const GeoCoord& gc, vector<StreetSegment>& segs) const
 {
 	return m_impl->getSegmentsThatStartWith(gc, segs);
-}
\ No newline at end of file
+}
+
+bool StreetMap::visitSegmentsThatStartWith(const GeoCoord& gc, const function<void(const StreetEdgeRef&)>& visit) const
+{
+	return m_impl->visitSegmentsThatStartWith(gc, visit);
+}
+
+bool StreetMap::saveSnapshot(string snapshotFile) const
+{
+	return m_impl->saveSnapshot(snapshotFile);
+}
+
+bool StreetMap::loadSnapshot(string snapshotFile)
+{
+	return m_impl->loadSnapshot(snapshotFile);
+}
+
+const StreetGraph* StreetMap::graph() const
+{
+	return m_impl->graph();
+}
+
+void StreetMap::buildContractionHierarchy()
+{
+	m_impl->buildContractionHierarchy();
+}
+
+const ContractionHierarchy* StreetMap::contractionHierarchy() const
+{
+	return m_impl->contractionHierarchy();
+}
+
+void StreetMap::buildLandmarks(unsigned int count)
+{
+	m_impl->buildLandmarks(count, LANDMARKS_AVOID);
+}
+
+void StreetMap::buildLandmarks(unsigned int count, LandmarkStrategy strategy)
+{
+	m_impl->buildLandmarks(count, strategy);
+}
+
+bool StreetMap::saveLandmarks(string landmarkFile) const
+{
+	return m_impl->saveLandmarks(landmarkFile);
+}
+
+bool StreetMap::loadLandmarks(string landmarkFile)
+{
+	return m_impl->loadLandmarks(landmarkFile);
+}
+
+const LandmarkTable* StreetMap::landmarks() const
+{
+	return m_impl->landmarks();
+}
+
+RouteCache* StreetMap::routeCache() const
+{
+	return m_impl->routeCache();
+}
+
+bool StreetMap::nearestNode(const GeoCoord& gc, double radiusMiles, GeoCoord& node) const
+{
+	return m_impl->nearestNode(gc, radiusMiles, node);
+}
+
+bool StreetMap::nearestPointOnSegment(const GeoCoord& gc, double radiusMiles, GeoCoord& point, StreetSegment& segment) const
+{
+	return m_impl->nearestPointOnSegment(gc, radiusMiles, point, segment);
+}
+
+const SpatialIndex* StreetMap::spatialIndex() const
+{
+	return m_impl->spatialIndex();
+}
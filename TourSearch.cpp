@@ -0,0 +1,980 @@
+// TourSearch.cpp
+
+#include "TourSearch.h"
+#include "WorkerPool.h"
+#include "CrowDistance.h"
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <cstdint>
+using namespace std;
+
+namespace
+{
+	// Smallest gain worth making a move for, so rounding can't make moves undo each other forever
+	const double MIN_GAIN = 1e-9;
+
+	// Length of the leg ClusterSearch ties a seam's ends together with; minus this is far below any trip
+	const double TIE_LENGTH = 1e6;
+
+	// Position of (x, y) along a Hilbert curve through a 65536 x 65536 grid
+	uint64_t hilbertIndex(unsigned int x, unsigned int y)
+	{
+		const unsigned int n = 1u << 16;
+		uint64_t d = 0;
+		for (unsigned int s = n / 2; s > 0; s /= 2) {
+			unsigned int rx = (x & s) != 0;
+			unsigned int ry = (y & s) != 0;
+			d += (uint64_t)s * s * ((3 * rx) ^ ry);
+			// Rotate the quadrant so the curve inside it runs the standard way
+			if (ry == 0) {
+				if (rx == 1) {
+					x = n - 1 - x;
+					y = n - 1 - y;
+				}
+				swap(x, y);
+			}
+		}
+		return d;
+	}
+
+	// Unit vectors of locations[stops[i]], as separate x, y and z arrays for the batched crow distances
+	void unitVectors(const vector<GeoCoord>& locations, const vector<int>& stops, vector<double>& xs, vector<double>& ys, vector<double>& zs)
+	{
+		xs.resize(stops.size());
+		ys.resize(stops.size());
+		zs.resize(stops.size());
+		for (size_t i = 0; i < stops.size(); ++i) {
+			unitVector(locations[stops[i]].latitude, locations[stops[i]].longitude, xs[i], ys[i], zs[i]);
+		}
+	}
+}
+
+//******************** StopDistances functions ********************************
+
+// Fills in every pair once. Crow distances are worked out a row at a time by the batched kernel.
+StopDistances::StopDistances(const vector<GeoCoord>& locations, const DistanceMatrix* matrix, const vector<int>& stops)
+	: m_size((int)stops.size()), m_dist((size_t)m_size * m_size, 0)
+{
+	if (matrix == nullptr) {
+		vector<double> xs, ys, zs;
+		unitVectors(locations, stops, xs, ys, zs);
+		for (int from = 0; from + 1 < m_size; ++from) {
+			double* row = &m_dist[(size_t)from * m_size];
+			crowMilesToMany(xs[from], ys[from], zs[from], &xs[from + 1], &ys[from + 1], &zs[from + 1], m_size - from - 1, row + from + 1);
+			for (int to = from + 1; to < m_size; ++to) {
+				m_dist[(size_t)to * m_size + from] = row[to];
+			}
+		}
+		return;
+	}
+	for (int from = 0; from < m_size; ++from) {
+		for (int to = from + 1; to < m_size; ++to) {
+			double d = between(locations, matrix, stops[from], stops[to]);
+			m_dist[(size_t)from * m_size + to] = d;
+			m_dist[(size_t)to * m_size + from] = d;
+		}
+	}
+}
+
+// Road distances take the shorter of the two directions
+double StopDistances::between(const vector<GeoCoord>& locations, const DistanceMatrix* matrix, int a, int b)
+{
+	if (a == b) {
+		return 0;
+	}
+	if (matrix != nullptr) {
+		return min(matrix->distance(a, b), matrix->distance(b, a));
+	}
+	return distanceEarthMiles(locations[a], locations[b]);
+}
+
+void StopDistances::set(int a, int b, double distance)
+{
+	m_dist[(size_t)a * m_size + b] = distance;
+	m_dist[(size_t)b * m_size + a] = distance;
+}
+
+double StopDistances::tripLength(const vector<int>& order) const
+{
+	if (order.empty()) {
+		return 0;
+	}
+	double distance = (*this)(0, order[0]);
+	for (size_t i = 0; i + 1 < order.size(); ++i) {
+		distance += (*this)(order[i], order[i + 1]);
+	}
+	return distance + (*this)(order.back(), 0);
+}
+
+//******************** LocalSearch functions **********************************
+
+LocalSearch::LocalSearch(const StopDistances& dist)
+	: m_dist(dist), m_size(dist.size()), m_neighborCount(min((int)NEIGHBORS, dist.size() - 1)), m_length(0), m_iterations(0)
+{
+	// Each stop's nearest others, nearest first
+	m_neighbors.resize((size_t)m_size * m_neighborCount);
+	vector<int> others;
+	for (int c = 0; c < m_size; ++c) {
+		others.clear();
+		for (int o = 0; o < m_size; ++o) {
+			if (o != c) {
+				others.push_back(o);
+			}
+		}
+		partial_sort(others.begin(), others.begin() + m_neighborCount, others.end(),
+			[&dist, c](int x, int y) { return dist(c, x) < dist(c, y); });
+		copy(others.begin(), others.begin() + m_neighborCount, m_neighbors.begin() + (size_t)c * m_neighborCount);
+	}
+}
+
+vector<int> LocalSearch::nearestNeighborOrder() const
+{
+	vector<int> order;
+	order.reserve(m_size - 1);
+	vector<char> visited(m_size, 0);
+	int at = 0;
+	for (int i = 1; i < m_size; ++i) {
+		int next = -1;
+		for (int c = 1; c < m_size; ++c) {
+			if (!visited[c] && (next < 0 || m_dist(at, c) < m_dist(at, next))) {
+				next = c;
+			}
+		}
+		visited[next] = 1;
+		order.push_back(next);
+		at = next;
+	}
+	return order;
+}
+
+long long LocalSearch::improve(vector<int>& order, SearchBudget& budget)
+{
+	m_iterations = 0;
+	// With fewer than 3 deliveries every order is as long as its reverse
+	if (m_size < 4) {
+		return 0;
+	}
+	vector<int> cycle;
+	cycle.reserve(m_size);
+	cycle.push_back(0);
+	cycle.insert(cycle.end(), order.begin(), order.end());
+	setTour(cycle);
+	m_length = m_dist.tripLength(order);
+
+	// Start with every stop to be looked at
+	m_dontLook.assign(m_size, 0);
+	m_queue.clear();
+	for (int i = 0; i < m_size; ++i) {
+		m_queue.push_back(m_tour[i]);
+	}
+
+	long long moves = 0;
+	long long limit = budget.iterationLimit(); // checked on the dot, as shared budgets can be small
+	while (!m_queue.empty()) {
+		if ((m_iterations % CHECK_EVERY == 0 || m_iterations == limit) && !budget.proceed(m_iterations, m_length)) {
+			break;
+		}
+		++m_iterations;
+		int a = m_queue.front();
+		m_queue.pop_front();
+		m_dontLook[a] = 1;
+		// Cheapest neighborhood first; a move wakes a up again, so it gets another look
+		if (tryTwoOpt(a) || tryOrOpt(a) || tryOr3Opt(a)) {
+			++moves;
+		}
+	}
+
+	// Read the trip off starting after the depot
+	int p = m_pos[0];
+	for (int i = 0; i < m_size - 1; ++i) {
+		if (++p == m_size) {
+			p = 0;
+		}
+		order[i] = m_tour[p];
+	}
+	return moves;
+}
+
+// Replaces legs a -> b and c -> d with a -> c and b -> d, looking both ways round the trip from a
+bool LocalSearch::tryTwoOpt(int a)
+{
+	const int* near = neighbors(a);
+	for (int forward = 1; forward >= 0; --forward) {
+		int b = forward ? succ(a) : pred(a);
+		double ab = m_dist(a, b);
+		for (int k = 0; k < m_neighborCount; ++k) {
+			int c = near[k];
+			double ac = m_dist(a, c);
+			// The new leg from a has to be shorter than the one it replaces for the move to gain
+			if (ac >= ab) {
+				break;
+			}
+			int d = forward ? succ(c) : pred(c);
+			if (c == b || d == a) {
+				continue;
+			}
+			double change = ac + m_dist(b, d) - ab - m_dist(c, d);
+			if (change < -MIN_GAIN) {
+				m_length += change;
+				if (forward) {
+					reversePath(b, c);
+				}
+				else {
+					reversePath(c, b);
+				}
+				wake(a);
+				wake(b);
+				wake(c);
+				wake(d);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Moves the run of 1 to 3 stops starting at a between two stops next to one of its ends
+bool LocalSearch::tryOrOpt(int a)
+{
+	int last = a;
+	for (int length = 1; length <= 3 && m_size - length >= 3; ++length) {
+		if (length > 1) {
+			last = succ(last);
+		}
+		int p = pred(a);
+		int n = succ(last);
+		double removeGain = m_dist(p, a) + m_dist(last, n) - m_dist(p, n);
+		if (removeGain <= MIN_GAIN) {
+			continue;
+		}
+		for (int end = 0; end < (length == 1 ? 1 : 2); ++end) {
+			int near = end == 0 ? a : last;
+			int far = end == 0 ? last : a;
+			const int* nearest = neighbors(near);
+			for (int k = 0; k < m_neighborCount; ++k) {
+				int c = nearest[k];
+				if (m_dist(near, c) >= removeGain) {
+					break;
+				}
+				if (offset(a, c) < length) {
+					continue; // c is in the run
+				}
+				// Put the run between c and its successor or predecessor once the run is taken out,
+				// with the end we found c from next to it
+				for (int after = 1; after >= 0; --after) {
+					int x = after ? c : (c == n ? p : pred(c));
+					int y = after ? (c == p ? n : succ(c)) : c;
+					if (x == p && y == n) {
+						continue;
+					}
+					int first = after ? near : far;
+					int second = after ? far : near;
+					double add = m_dist(x, first) + m_dist(second, y) - m_dist(x, y);
+					if (add - removeGain < -MIN_GAIN) {
+						m_length += add - removeGain;
+						vector<int> run;
+						for (int s = a; ; s = succ(s)) {
+							run.push_back(s);
+							if (s == last) {
+								break;
+							}
+						}
+						if (first != a) {
+							reverse(run.begin(), run.end());
+						}
+						vector<int> cycle;
+						cycle.reserve(m_size);
+						for (int s = n; ; s = succ(s)) {
+							cycle.push_back(s);
+							if (s == x) {
+								cycle.insert(cycle.end(), run.begin(), run.end());
+							}
+							if (s == p) {
+								break;
+							}
+						}
+						setTour(cycle);
+						wake(p);
+						wake(n);
+						wake(x);
+						wake(y);
+						wake(a);
+						wake(last);
+						return true;
+					}
+				}
+			}
+		}
+	}
+	return false;
+}
+
+// Turns a -> [a1 .. b] -> [b1 .. c] -> c1 into a -> [b1 .. c] -> [a1 .. b] -> c1.
+// Like Lin-Kernighan, it grows the move one leg at a time and only while the gain so far is positive:
+// a -> b1 must be shorter than a -> a1, and b -> c1 shorter than what that leaves.
+bool LocalSearch::tryOr3Opt(int a)
+{
+	int a1 = succ(a);
+	const int* nearA = neighbors(a);
+	for (int k = 0; k < m_neighborCount; ++k) {
+		int b1 = nearA[k];
+		double g0 = m_dist(a, a1) - m_dist(a, b1);
+		if (g0 <= MIN_GAIN) {
+			break;
+		}
+		int ob = offset(a, b1);
+		if (ob < 2) {
+			continue; // [a1 .. b] would be empty
+		}
+		int b = pred(b1);
+		double g1 = g0 + m_dist(b, b1);
+		const int* nearB = neighbors(b);
+		for (int j = 0; j < m_neighborCount; ++j) {
+			int c1 = nearB[j];
+			double g2 = g1 - m_dist(b, c1);
+			if (g2 <= MIN_GAIN) {
+				break;
+			}
+			// c1 has to come after b1 and no later than a, going forward
+			int oc = c1 == a ? m_size : offset(a, c1);
+			if (oc <= ob) {
+				continue;
+			}
+			int c = pred(c1);
+			double gain = g2 + m_dist(c, c1) - m_dist(c, a1);
+			if (gain > MIN_GAIN) {
+				m_length -= gain;
+				vector<int> cycle;
+				cycle.reserve(m_size);
+				cycle.push_back(a);
+				for (int s = b1; ; s = succ(s)) {
+					cycle.push_back(s);
+					if (s == c) {
+						break;
+					}
+				}
+				for (int s = a1; ; s = succ(s)) {
+					cycle.push_back(s);
+					if (s == b) {
+						break;
+					}
+				}
+				for (int s = c1; s != a; s = succ(s)) {
+					cycle.push_back(s);
+				}
+				setTour(cycle);
+				wake(a);
+				wake(a1);
+				wake(b);
+				wake(b1);
+				wake(c);
+				wake(c1);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Reversing either side of the cycle gives the same trip, so reverse the shorter one
+void LocalSearch::reversePath(int from, int to)
+{
+	int length = offset(from, to) + 1;
+	if (2 * length > m_size) {
+		int newFrom = succ(to);
+		to = pred(from);
+		from = newFrom;
+		length = m_size - length;
+	}
+	int i = m_pos[from];
+	int j = m_pos[to];
+	for (int k = 0; k < length / 2; ++k) {
+		swap(m_tour[i], m_tour[j]);
+		m_pos[m_tour[i]] = i;
+		m_pos[m_tour[j]] = j;
+		if (++i == m_size) {
+			i = 0;
+		}
+		if (--j < 0) {
+			j = m_size - 1;
+		}
+	}
+}
+
+void LocalSearch::setTour(const vector<int>& cycle)
+{
+	m_tour = cycle;
+	m_pos.resize(m_size);
+	for (int i = 0; i < m_size; ++i) {
+		m_pos[m_tour[i]] = i;
+	}
+}
+
+void LocalSearch::wake(int c)
+{
+	if (m_dontLook[c]) {
+		m_dontLook[c] = 0;
+		m_queue.push_back(c);
+	}
+}
+
+//******************** ParallelTempering functions ****************************
+
+ParallelTempering::ParallelTempering(const StopDistances& dist, unsigned int chains, unsigned int seed)
+	: m_dist(dist), m_chains(max(chains, 1u)), m_iterations(0)
+{
+	seed_seq tradeSeed{ seed };
+	m_rng.seed(tradeSeed);
+	for (unsigned int k = 0; k < m_chains.size(); ++k) {
+		seed_seq chainSeed{ seed, k + 1 };
+		m_chains[k].rng.seed(chainSeed);
+	}
+}
+
+long long ParallelTempering::improve(vector<int>& order, SearchBudget& budget)
+{
+	m_iterations = 0;
+	int n = (int)order.size();
+	if (n < 3) {
+		return 0;
+	}
+
+	// Temperatures spaced evenly on a log scale, from the average leg of the starting trip
+	// down to a hundredth of it. The hottest chain still takes a move that adds a whole leg
+	// about a third of the time; the coldest takes almost nothing uphill.
+	double length = m_dist.tripLength(order);
+	double leg = length / (n + 1);
+	double hot = leg;
+	double cold = leg / 100;
+	int chains = (int)m_chains.size();
+	for (int k = 0; k < chains; ++k) {
+		Chain& chain = m_chains[k];
+		chain.temperature = chains == 1 ? cold : cold * pow(hot / cold, (double)k / (chains - 1));
+		chain.order = order;
+		chain.length = length;
+		chain.moves = 0;
+	}
+
+	// Every chain gets as many moves as the single annealer would, unless the budget allows fewer
+	long long steps = max(1LL, budget.limit((long long)pow(n, 2.5) * chains) / chains / ROUNDS);
+	vector<int> best = order;
+	double bestLength = length;
+	for (int round = 0; round < ROUNDS; ++round) {
+		if (!budget.proceed(m_iterations, bestLength)) {
+			break;
+		}
+		WorkerPool::shared().run(chains, [this, steps, &budget](unsigned int k, unsigned int) {
+			runChain(m_chains[k], steps, budget);
+		});
+		for (int k = 0; k < chains; ++k) {
+			m_iterations += m_chains[k].steps;
+		}
+		for (int k = 0; k < chains; ++k) {
+			if (m_chains[k].bestLength < bestLength) {
+				bestLength = m_chains[k].bestLength;
+				best = m_chains[k].best;
+			}
+		}
+		// Offer trades between neighboring temperatures, even pairs one round and odd pairs the next
+		for (int k = round % 2; k + 1 < chains; k += 2) {
+			Chain& colder = m_chains[k];
+			Chain& hotter = m_chains[k + 1];
+			double exponent = (1 / colder.temperature - 1 / hotter.temperature) * (colder.length - hotter.length);
+			if (exponent >= 0 || uniform(m_rng) < exp(exponent)) {
+				colder.order.swap(hotter.order);
+				swap(colder.length, hotter.length);
+			}
+		}
+	}
+
+	long long moves = 0;
+	for (int k = 0; k < chains; ++k) {
+		moves += m_chains[k].moves;
+	}
+	order = best;
+	return moves;
+}
+
+void ParallelTempering::runChain(Chain& chain, long long steps, const SearchBudget& budget) const
+{
+	vector<int>& order = chain.order;
+	int n = (int)order.size();
+	chain.best = order;
+	chain.bestLength = chain.length;
+	for (chain.steps = 0; chain.steps < steps; ++chain.steps) {
+		if (chain.steps % CHECK_EVERY == CHECK_EVERY - 1 && budget.expired()) {
+			break;
+		}
+		// Reverse order[i .. j - 1], replacing the legs a -> b and c -> d with a -> c and b -> d
+		// (the depot is before index 0 and at index n)
+		int i = (int)(chain.rng() % (n + 1));
+		int j = (int)(chain.rng() % (n + 1));
+		if (i > j) {
+			swap(i, j);
+		}
+		if (j - i < 2) {
+			continue;
+		}
+		int a = i == 0 ? 0 : order[i - 1];
+		int b = order[i];
+		int c = order[j - 1];
+		int d = j == n ? 0 : order[j];
+		double change = m_dist(a, c) + m_dist(b, d) - m_dist(a, b) - m_dist(c, d);
+		if (change > 0 && uniform(chain.rng) >= exp(-change / chain.temperature)) {
+			continue;
+		}
+		reverse(order.begin() + i, order.begin() + j);
+		chain.length += change;
+		++chain.moves;
+		if (chain.length < chain.bestLength - 1e-9) {
+			chain.best = order;
+			chain.bestLength = chain.length;
+		}
+	}
+	// Keep the running total from drifting
+	chain.length = m_dist.tripLength(order);
+}
+
+//******************** HeldKarp functions *************************************
+
+// Deliveries are numbered by bit: bit j of a set is stop j + 1
+HeldKarp::HeldKarp(const StopDistances& dist)
+	: m_dist(dist), m_stops(dist.size() - 1), m_width((m_stops + 3) / 4 * 4)
+{
+	m_legs.assign((size_t)m_width * m_width, numeric_limits<double>::infinity());
+	for (int k = 0; k < m_stops; ++k) {
+		for (int j = 0; j < m_stops; ++j) {
+			if (j != k) {
+				m_legs[(size_t)k * m_width + j] = dist(j + 1, k + 1);
+			}
+		}
+	}
+}
+
+void HeldKarp::solve(vector<int>& order)
+{
+	int n = m_stops;
+	if (n < 3) {
+		return;
+	}
+	unsigned int full = (1u << n) - 1;
+	// Ends that aren't in a set stay infinite, which keeps them out of every minimum without a branch
+	m_table.assign((size_t)(full + 1) * m_width, numeric_limits<double>::infinity());
+	for (int k = 0; k < n; ++k) {
+		m_table[(size_t)(1u << k) * m_width + k] = m_dist(0, k + 1);
+	}
+	// Every set is filled in after all of its subsets because they're smaller numbers
+	for (unsigned int set = 1; set <= full; ++set) {
+		if ((set & (set - 1)) == 0) {
+			continue; // one delivery, straight from the depot
+		}
+		for (int k = 0; k < n; ++k) {
+			if (set & (1u << k)) {
+				m_table[(size_t)set * m_width + k] = best(set, k);
+			}
+		}
+	}
+
+	// Close the trip back to the depot, then walk the table backwards from the best last stop
+	int last = 0;
+	for (int k = 1; k < n; ++k) {
+		if (m_table[(size_t)full * m_width + k] + m_dist(k + 1, 0) < m_table[(size_t)full * m_width + last] + m_dist(last + 1, 0)) {
+			last = k;
+		}
+	}
+	unsigned int set = full;
+	for (int i = n - 1; i > 0; --i) {
+		order[i] = last + 1;
+		int from = cameFrom(set, last);
+		set ^= 1u << last;
+		last = from;
+	}
+	order[0] = last + 1;
+}
+
+double HeldKarp::best(unsigned int set, int k) const
+{
+	const double* previous = &m_table[(size_t)(set ^ (1u << k)) * m_width];
+	const double* legs = &m_legs[(size_t)k * m_width];
+	double lane[4];
+	for (int l = 0; l < 4; ++l) {
+		lane[l] = previous[l] + legs[l];
+	}
+	for (int j = 4; j < m_width; j += 4) {
+		for (int l = 0; l < 4; ++l) {
+			lane[l] = min(lane[l], previous[j + l] + legs[j + l]);
+		}
+	}
+	return min(min(lane[0], lane[1]), min(lane[2], lane[3]));
+}
+
+// The same sums as best, so the one that gave the table entry matches it exactly
+int HeldKarp::cameFrom(unsigned int set, int k) const
+{
+	const double* previous = &m_table[(size_t)(set ^ (1u << k)) * m_width];
+	const double* legs = &m_legs[(size_t)k * m_width];
+	double length = m_table[(size_t)set * m_width + k];
+	for (int j = 0; j < m_stops; ++j) {
+		if (previous[j] + legs[j] == length) {
+			return j;
+		}
+	}
+	return -1;
+}
+
+//******************** SearchBudget functions *********************************
+
+SearchBudget::SearchBudget()
+	: m_start(chrono::steady_clock::now()), m_deadlineMs(0), m_iterationLimit(0), m_cancel(nullptr),
+	m_lastProgressMs(0), m_stopped(false), m_limited(false)
+{
+}
+
+bool SearchBudget::proceed(long long iterations, double bestLength)
+{
+	if (m_stopped) {
+		return false;
+	}
+	if (expired() || (m_iterationLimit > 0 && iterations >= m_iterationLimit)) {
+		m_stopped = true;
+		return false;
+	}
+	double elapsed = elapsedMs();
+	if (m_progress && elapsed - m_lastProgressMs >= PROGRESS_MS) {
+		m_lastProgressMs = elapsed;
+		m_progress(iterations, bestLength);
+	}
+	return true;
+}
+
+SearchBudget SearchBudget::share(long long iterations) const
+{
+	SearchBudget copy(*this);
+	copy.m_progress = nullptr;
+	if (m_iterationLimit > 0) {
+		copy.m_iterationLimit = max(iterations, 1LL);
+	}
+	return copy;
+}
+
+void SearchBudget::merge(const SearchBudget& shared)
+{
+	m_stopped = m_stopped || shared.m_stopped;
+	m_limited = m_limited || shared.m_limited;
+}
+
+bool SearchBudget::expired() const
+{
+	return (m_cancel != nullptr && m_cancel->load(memory_order_relaxed)) ||
+		(m_deadlineMs > 0 && elapsedMs() >= m_deadlineMs);
+}
+
+long long SearchBudget::limit(long long planned)
+{
+	if (m_iterationLimit > 0 && m_iterationLimit < planned) {
+		m_limited = true;
+		return m_iterationLimit;
+	}
+	return planned;
+}
+
+double SearchBudget::elapsedMs() const
+{
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - m_start).count();
+}
+
+//******************** ClusterSearch functions ********************************
+
+ClusterSearch::ClusterSearch(const vector<GeoCoord>& locations, const DistanceMatrix* matrix, const StreetMap* roads)
+	: m_locations(locations), m_matrix(matrix), m_roads(roads), m_iterations(0), m_result(DELIVERY_SUCCESS)
+{
+}
+
+// Crow-flies trips are measured all at once by the batched kernel
+double ClusterSearch::tripLength(const vector<int>& order) const
+{
+	if (order.empty()) {
+		return 0;
+	}
+	if (m_matrix == nullptr) {
+		vector<int> trip(1, 0);
+		trip.insert(trip.end(), order.begin(), order.end());
+		trip.push_back(0);
+		vector<double> xs, ys, zs;
+		unitVectors(m_locations, trip, xs, ys, zs);
+		return crowPathMiles(xs.data(), ys.data(), zs.data(), trip.size());
+	}
+	double length = distance(0, order[0]);
+	for (size_t i = 0; i + 1 < order.size(); ++i) {
+		length += distance(order[i], order[i + 1]);
+	}
+	return length + distance(order.back(), 0);
+}
+
+long long ClusterSearch::improve(vector<int>& order, SearchBudget& budget)
+{
+	m_iterations = 0;
+	m_result = DELIVERY_SUCCESS;
+	int n = (int)order.size();
+	if (n < 3) {
+		return 0;
+	}
+	long long moves = 0;
+	WorkerPool& pool = WorkerPool::shared();
+	// An iteration limit covers the whole call: the sectors split it by size, then ordering the
+	// sectors and repairing the seams get what's left
+	long long limit = budget.iterationLimit();
+
+	// Tour every sector
+	vector<vector<int>> parts = sectors();
+	int sectorCount = (int)parts.size();
+	vector<vector<int>> tours(sectorCount);
+	vector<long long> partMoves(sectorCount, 0), partIterations(sectorCount, 0);
+	vector<DeliveryResult> partResults(sectorCount, DELIVERY_SUCCESS);
+	vector<SearchBudget> partBudgets;
+	partBudgets.reserve(sectorCount);
+	for (int k = 0; k < sectorCount; ++k) {
+		partBudgets.push_back(budget.share(limit * (long long)parts[k].size() / n));
+	}
+	pool.run(sectorCount, [&](unsigned int k, unsigned int) {
+		tours[k] = tour(parts[k], partBudgets[k], partMoves[k], partIterations[k], partResults[k]);
+	});
+	for (int k = 0; k < sectorCount; ++k) {
+		moves += partMoves[k];
+		m_iterations += partIterations[k];
+		budget.merge(partBudgets[k]);
+		if (partResults[k] != DELIVERY_SUCCESS) {
+			m_result = partResults[k];
+		}
+	}
+	if (m_result != DELIVERY_SUCCESS) {
+		return moves;
+	}
+
+	// Order the sectors by a trip from the depot through their centers
+	vector<GeoCoord> centers(sectorCount + 1);
+	centers[0] = m_locations[0];
+	for (int k = 0; k < sectorCount; ++k) {
+		double lat = 0, lon = 0;
+		for (size_t i = 0; i < parts[k].size(); ++i) {
+			lat += m_locations[parts[k][i]].latitude;
+			lon += m_locations[parts[k][i]].longitude;
+		}
+		centers[k + 1].latitude = lat / parts[k].size();
+		centers[k + 1].longitude = lon / parts[k].size();
+	}
+	vector<int> sectorOrder(sectorCount);
+	iota(sectorOrder.begin(), sectorOrder.end(), 1);
+	if (sectorCount >= 3) {
+		vector<int> all(sectorCount + 1);
+		iota(all.begin(), all.end(), 0);
+		StopDistances centerDistances(centers, nullptr, all);
+		if (sectorCount <= HeldKarp::MAX_STOPS) {
+			HeldKarp solver(centerDistances);
+			solver.solve(sectorOrder);
+		}
+		else {
+			LocalSearch search(centerDistances);
+			sectorOrder = search.nearestNeighborOrder();
+			if (limit == 0 || m_iterations < limit) {
+				SearchBudget orderBudget = budget.share(limit - m_iterations);
+				search.improve(sectorOrder, orderBudget);
+				m_iterations += search.iterations();
+				budget.merge(orderBudget);
+			}
+		}
+	}
+
+	// Chain the sector tours, cutting each loop open at the leg that costs least to give up for
+	// the legs in from the previous sector and on toward the next sector's center
+	vector<int> cycle;
+	cycle.reserve(n + 1);
+	cycle.push_back(0);
+	vector<int> seams; // where each sector starts in cycle
+	for (int t = 0; t < sectorCount; ++t) {
+		const vector<int>& loop = tours[sectorOrder[t] - 1];
+		const GeoCoord& next = t + 1 < sectorCount ? centers[sectorOrder[t + 1]] : m_locations[0];
+		int size = (int)loop.size();
+		int bestCut = 0;
+		bool bestForward = true;
+		double bestCost = numeric_limits<double>::infinity();
+		for (int i = 0; i < size; ++i) {
+			int a = loop[i];
+			int b = loop[(i + 1) % size];
+			double dropped = size > 1 ? distance(a, b) : 0;
+			// Forward enters at b and leaves from a; backward enters at a and leaves from b
+			double forward = distance(cycle.back(), b) + distanceEarthMiles(m_locations[a], next) - dropped;
+			double backward = distance(cycle.back(), a) + distanceEarthMiles(m_locations[b], next) - dropped;
+			if (forward < bestCost) {
+				bestCost = forward;
+				bestCut = i;
+				bestForward = true;
+			}
+			if (backward < bestCost) {
+				bestCost = backward;
+				bestCut = i;
+				bestForward = false;
+			}
+		}
+		seams.push_back((int)cycle.size());
+		for (int i = 0; i < size; ++i) {
+			cycle.push_back(bestForward ? loop[(bestCut + 1 + i) % size] : loop[((bestCut - i) % size + size) % size]);
+		}
+	}
+
+	// Repair the seams. Each one's stretch has to stay clear of the others' and of their fixed ends.
+	int total = (int)cycle.size();
+	int gap = total - seams.back() + seams[0]; // the last sector and the depot
+	for (int t = 0; t + 1 < sectorCount; ++t) {
+		gap = min(gap, seams[t + 1] - seams[t]);
+	}
+	int half = min((int)SEAM_STOPS, (gap - 2) / 2);
+	if (half >= 2 && limit > 0 && m_iterations >= limit) {
+		budget.limit(limit + 1); // the sectors used it all up, so the seams go unrepaired
+	}
+	else if (half >= 2) {
+		vector<long long> seamMoves(sectorCount, 0), seamIterations(sectorCount, 0);
+		vector<DeliveryResult> seamResults(sectorCount, DELIVERY_SUCCESS);
+		vector<SearchBudget> seamBudgets(sectorCount, budget.share((limit - m_iterations) / sectorCount));
+		pool.run(sectorCount, [&](unsigned int t, unsigned int) {
+			repair(cycle, seams[t] - half, 2 * half, seamBudgets[t], seamMoves[t], seamIterations[t], seamResults[t]);
+		});
+		for (int t = 0; t < sectorCount; ++t) {
+			moves += seamMoves[t];
+			m_iterations += seamIterations[t];
+			budget.merge(seamBudgets[t]);
+			if (seamResults[t] != DELIVERY_SUCCESS) {
+				m_result = seamResults[t];
+			}
+		}
+		if (m_result != DELIVERY_SUCCESS) {
+			return moves;
+		}
+	}
+
+	// A seam's stretch may have moved the depot, so read the trip off from wherever it is now
+	int depotAt = (int)(find(cycle.begin(), cycle.end(), 0) - cycle.begin());
+	for (int i = 0; i < n; ++i) {
+		order[i] = cycle[(depotAt + 1 + i) % total];
+	}
+	return moves;
+}
+
+vector<vector<int>> ClusterSearch::sectors() const
+{
+	int n = (int)m_locations.size() - 1;
+	double minLat = m_locations[1].latitude, maxLat = minLat;
+	double minLon = m_locations[1].longitude, maxLon = minLon;
+	for (int i = 2; i <= n; ++i) {
+		minLat = min(minLat, m_locations[i].latitude);
+		maxLat = max(maxLat, m_locations[i].latitude);
+		minLon = min(minLon, m_locations[i].longitude);
+		maxLon = max(maxLon, m_locations[i].longitude);
+	}
+	// Square cells, so the curve doesn't stretch along the longer side
+	double cell = max(maxLat - minLat, maxLon - minLon) / 65535;
+	if (cell <= 0) {
+		cell = 1;
+	}
+	vector<pair<uint64_t, int>> keyed(n);
+	for (int i = 1; i <= n; ++i) {
+		unsigned int x = (unsigned int)((m_locations[i].longitude - minLon) / cell);
+		unsigned int y = (unsigned int)((m_locations[i].latitude - minLat) / cell);
+		keyed[i - 1] = make_pair(hilbertIndex(x, y), i);
+	}
+	sort(keyed.begin(), keyed.end());
+
+	int count = (n + SECTOR_STOPS - 1) / SECTOR_STOPS;
+	vector<vector<int>> parts(count);
+	for (int k = 0; k < count; ++k) {
+		for (int i = (int)((long long)k * n / count); i < (int)((long long)(k + 1) * n / count); ++i) {
+			parts[k].push_back(keyed[i].second);
+		}
+	}
+	return parts;
+}
+
+StopDistances ClusterSearch::distances(const vector<int>& stops, DeliveryResult& result) const
+{
+	if (m_matrix != nullptr || m_roads == nullptr) {
+		return StopDistances(m_locations, m_matrix, stops);
+	}
+	// A matrix of just these stops; a run inside a pooled sector or seam routes on that thread
+	vector<GeoCoord> places;
+	vector<int> rows(stops.size());
+	places.reserve(stops.size());
+	for (size_t i = 0; i < stops.size(); ++i) {
+		places.push_back(m_locations[stops[i]]);
+		rows[i] = (int)i;
+	}
+	DistanceMatrix matrix(m_roads);
+	DeliveryResult routed = matrix.compute(places);
+	if (routed != DELIVERY_SUCCESS) {
+		result = routed;
+	}
+	return StopDistances(places, &matrix, rows);
+}
+
+vector<int> ClusterSearch::tour(const vector<int>& stops, SearchBudget& budget, long long& moves, long long& iterations,
+	DeliveryResult& result) const
+{
+	// Every loop through 3 stops or fewer is as long as any other
+	if (stops.size() <= 3) {
+		return stops;
+	}
+	StopDistances table = distances(stops, result);
+	if (result != DELIVERY_SUCCESS) {
+		return stops;
+	}
+	LocalSearch search(table);
+	vector<int> order = search.nearestNeighborOrder();
+	moves += search.improve(order, budget);
+	iterations += search.iterations();
+	vector<int> loop;
+	loop.reserve(stops.size());
+	loop.push_back(stops[0]);
+	for (size_t i = 0; i < order.size(); ++i) {
+		loop.push_back(stops[order[i]]);
+	}
+	return loop;
+}
+
+void ClusterSearch::repair(vector<int>& cycle, int first, int count, SearchBudget& budget, long long& moves, long long& iterations,
+	DeliveryResult& result) const
+{
+	int total = (int)cycle.size();
+	auto at = [total](int i) { return (i % total + total) % total; };
+	// Stop 0 is the fixed end before the stretch, stop 1 the one after, tied together so they stay neighbors
+	vector<int> stops;
+	stops.reserve(count + 2);
+	stops.push_back(cycle[at(first - 1)]);
+	stops.push_back(cycle[at(first + count)]);
+	for (int i = 0; i < count; ++i) {
+		stops.push_back(cycle[at(first + i)]);
+	}
+	StopDistances table = distances(stops, result);
+	if (result != DELIVERY_SUCCESS) {
+		return;
+	}
+	table.set(0, 1, -TIE_LENGTH);
+	LocalSearch search(table);
+	vector<int> order(count + 1);
+	iota(order.begin(), order.end() - 1, 2);
+	order.back() = 1;
+	moves += search.improve(order, budget);
+	iterations += search.iterations();
+
+	// The loop runs 0 -> order -> 0 with 1 at one end; make it run from 0 through the stretch to 1
+	if (order.front() == 1) {
+		reverse(order.begin(), order.end());
+	}
+	if (order.back() != 1) {
+		return; // the tie was given up, which no improving move can do
+	}
+	for (int i = 0; i < count; ++i) {
+		cycle[at(first + i)] = stops[order[i]];
+	}
+}
@@ -0,0 +1,250 @@
+#ifndef TS_H_
+#define TS_H_
+
+// TourSearch.h
+
+// Building blocks for DeliveryOptimizer. A trip's stops are numbered 0 for the depot
+// and i + 1 for deliveries[i], and an order is the list of delivery stops in the
+// sequence they're visited; the trip starts and ends at the depot.
+
+#include "provided.h"
+#include "DistanceMatrix.h"
+#include <vector>
+#include <deque>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+// Distances between every pair of stops. The table is symmetric: crow-flies distances
+// are, and for road distances the two directions are the same shortest path found by
+// two different searches, so any rounding difference between them is evened out.
+// That's what lets a move be scored from its end points alone: the stops a reversed
+// stretch is driven through cover the same distance either way round.
+class StopDistances
+{
+public:
+	// Stop i is locations[stops[i]], which is also row and column stops[i] of matrix.
+	// Road distances from matrix, or crow-flies distances if it's nullptr.
+	StopDistances(const std::vector<GeoCoord>& locations, const DistanceMatrix* matrix, const std::vector<int>& stops);
+	int size() const { return m_size; } // number of stops, depot included
+	double operator()(int from, int to) const { return m_dist[(size_t)from * m_size + to]; }
+	// Overrides the distance between two stops (both ways)
+	void set(int a, int b, double distance);
+	// Length of the trip from the depot through order and back
+	double tripLength(const std::vector<int>& order) const;
+	// The distance the table would hold between locations a and b, without a table
+	static double between(const std::vector<GeoCoord>& locations, const DistanceMatrix* matrix, int a, int b);
+private:
+	int m_size;
+	std::vector<double> m_dist;
+};
+
+// When an engine has to stop early. Engines call proceed() every so often with the iterations
+// they've done so far and the best trip length they've found, and stop with that best trip
+// once it returns false: after the deadline, after the iteration limit, or once another thread
+// has set the cancel flag. proceed() also passes progress on to the callback, at most every
+// PROGRESS_MS milliseconds. The clock starts when the budget is made.
+class SearchBudget
+{
+public:
+	SearchBudget(); // no limits
+	void setDeadline(double milliseconds) { m_deadlineMs = milliseconds; } // 0 for none
+	void setIterationLimit(long long iterations) { m_iterationLimit = iterations; } // 0 for none
+	long long iterationLimit() const { return m_iterationLimit; }
+	void setCancelFlag(const std::atomic<bool>* cancel) { m_cancel = cancel; }
+	void setProgress(const std::function<void(long long iterations, double bestLength)>& progress) { m_progress = progress; }
+
+	bool proceed(long long iterations, double bestLength);
+	// A copy for one of several searches running at once: same clock, deadline and cancel flag, no
+	// progress callback, and under an iteration limit a limit of its own of that many (at least 1)
+	SearchBudget share(long long iterations) const;
+	// Takes in whether a shared copy was stopped
+	void merge(const SearchBudget& shared);
+	// Just the deadline and the cancel flag, without recording anything, so it's safe to call
+	// from several threads at once
+	bool expired() const;
+	// How many of the planned iterations an engine may run under the iteration limit
+	long long limit(long long planned);
+	// True if a limit was hit or the search was cancelled
+	bool stopped() const { return m_stopped || m_limited; }
+	double elapsedMs() const;
+private:
+	enum { PROGRESS_MS = 10 };
+	std::chrono::steady_clock::time_point m_start;
+	double m_deadlineMs;
+	long long m_iterationLimit;
+	const std::atomic<bool>* m_cancel;
+	std::function<void(long long, double)> m_progress;
+	double m_lastProgressMs;
+	bool m_stopped; // proceed has returned false
+	bool m_limited; // limit has cut a plan short
+};
+
+// Local search to a local optimum of three neighborhoods, each looked for through
+// short lists of every stop's nearest other stops:
+//  - 2-opt: reverse a stretch of the trip, replacing two legs
+//  - Or-opt: move a run of up to 3 stops elsewhere, either way round
+//  - or-3opt: swap two adjacent stretches, replacing three legs (the sequential
+//    3-opt move of Lin-Kernighan that needs no reversal)
+// "Don't-look" bits skip stops whose surroundings haven't changed since nothing
+// improving was found around them, so each pass only revisits where moves happened.
+class LocalSearch
+{
+public:
+	LocalSearch(const StopDistances& dist);
+	// Improves order in place and returns the number of moves made. Every stop looked at
+	// counts as an iteration, and if budget runs out the trip reached so far is kept.
+	long long improve(std::vector<int>& order, SearchBudget& budget);
+	long long iterations() const { return m_iterations; } // by the last improve
+	double length() const { return m_length; } // of the trip the last improve left, as its moves scored it
+	// Nearest-neighbor order: always drive to the closest stop not visited yet
+	std::vector<int> nearestNeighborOrder() const;
+private:
+	enum { NEIGHBORS = 10, CHECK_EVERY = 64 }; // stops looked at between budget checks
+	const StopDistances& m_dist;
+	int m_size;
+	std::vector<int> m_neighbors; // m_neighbors[c * m_neighborCount + k] is c's k-th nearest stop
+	int m_neighborCount;
+
+	// The trip as a cycle: m_tour[i] is the stop in position i, m_pos[stop] its position
+	std::vector<int> m_tour, m_pos;
+	std::vector<char> m_dontLook; // set for stops not in m_queue
+	std::deque<int> m_queue; // stops to look at again
+	double m_length; // of the current tour
+	long long m_iterations;
+
+	int succ(int c) const { return m_tour[m_pos[c] + 1 == m_size ? 0 : m_pos[c] + 1]; }
+	int pred(int c) const { return m_tour[m_pos[c] == 0 ? m_size - 1 : m_pos[c] - 1]; }
+	// Steps forward from a to b
+	int offset(int a, int b) const { return m_pos[b] >= m_pos[a] ? m_pos[b] - m_pos[a] : m_pos[b] - m_pos[a] + m_size; }
+	const int* neighbors(int c) const { return &m_neighbors[(size_t)c * m_neighborCount]; }
+
+	// Each tries the moves around stop a and makes the first improving one; true if it made one
+	bool tryTwoOpt(int a);
+	bool tryOrOpt(int a);
+	bool tryOr3Opt(int a);
+
+	// Reverses the path from stop from forward to stop to
+	void reversePath(int from, int to);
+	// Replaces the tour with the given cycle of stops
+	void setTour(const std::vector<int>& cycle);
+	// Puts stops back on the queue after a move changed their legs
+	void wake(int c);
+};
+
+// Parallel tempering: several annealing chains, each at its own fixed temperature from
+// hot (wanders freely) to cold (only goes downhill), run side by side on the shared
+// WorkerPool. Between rounds, chains at neighboring temperatures trade trips with the
+// Metropolis probability, so a good trip found by a hot chain sinks to the cold ones
+// and a cold chain stuck in a poor valley gets lifted out. Each chain draws from its
+// own generator seeded from (seed, chain), and the trades are drawn on the calling
+// thread, so the result depends only on the seed and the number of chains, however
+// the pool happens to schedule them.
+class ParallelTempering
+{
+public:
+	ParallelTempering(const StopDistances& dist, unsigned int chains, unsigned int seed);
+	// Improves order in place to the best trip any chain visited and returns the number of moves made.
+	// Every move tried counts as an iteration; budget is checked between rounds.
+	long long improve(std::vector<int>& order, SearchBudget& budget);
+	long long iterations() const { return m_iterations; } // by the last improve
+private:
+	struct Chain {
+		std::mt19937 rng;
+		double temperature;
+		std::vector<int> order;
+		double length;
+		std::vector<int> best; // shortest trip this chain has seen since the last round
+		double bestLength;
+		long long moves;
+		long long steps; // run in the last round
+	};
+	enum { ROUNDS = 200, CHECK_EVERY = 4096 }; // trades tried over a run; steps between deadline checks
+	const StopDistances& m_dist;
+	std::vector<Chain> m_chains;
+	std::mt19937 m_rng; // for the trades
+	long long m_iterations;
+
+	// Runs steps random stretch reversals at the chain's temperature, fewer if budget expires
+	void runChain(Chain& chain, long long steps, const SearchBudget& budget) const;
+	// Uniform in [0, 1) from 24 random bits, the same on every platform
+	static double uniform(std::mt19937& rng) { return (rng() >> 8) * (1.0 / 16777216); }
+};
+
+// Exact shortest trip by Held-Karp dynamic programming: for every set of deliveries and
+// every one of them to end at, the shortest path from the depot through exactly that set.
+// It takes O(2^N * N^2) time and O(2^N * N) memory, so it's only for small orders.
+// Each set's row of path lengths is padded to a multiple of 4 stops, and the minimum over
+// the stop before the last is taken in 4 independent lanes, so the inner loop compiles to
+// packed SIMD adds and mins without relaxing floating-point rules.
+class HeldKarp
+{
+public:
+	enum { MAX_STOPS = 16 }; // 8MB of table at the limit
+	HeldKarp(const StopDistances& dist);
+	// Replaces order with a shortest one; order must have at most MAX_STOPS stops
+	void solve(std::vector<int>& order);
+private:
+	const StopDistances& m_dist;
+	int m_stops; // deliveries
+	int m_width; // m_stops rounded up to a multiple of 4
+	std::vector<double> m_legs; // m_legs[k * m_width + j]: delivery j to delivery k (bit numbers), infinity in the padding
+	std::vector<double> m_table; // m_table[set * m_width + k]: shortest path through set ending at k
+
+	// Shortest path through set ending at k, from the table entries for the set without k
+	double best(unsigned int set, int k) const;
+	// The stop before k on that path
+	int cameFrom(unsigned int set, int k) const;
+};
+
+// For orders with thousands of stops, where a table of every pair wouldn't fit and one local
+// search over everything would take too long:
+//  1. The deliveries are cut into sectors of about SECTOR_STOPS consecutive stops along a
+//     Hilbert curve, which keeps each sector compact.
+//  2. Every sector is toured on its own by LocalSearch, all sectors at once on the WorkerPool.
+//  3. The sector tours are chained in the order of a short trip from the depot through the
+//     sectors' centers, each cut open where it best joins the one before it.
+//  4. The stretch of trip around each seam is searched again with its two outer ends held in
+//     place (they're tied together by a leg of huge negative length no move will give up),
+//     again all seams at once.
+// Each table only covers one sector or one seam, so with road distances routed on the map
+// rather than taken from a matrix, only the pairs in some table are ever routed.
+class ClusterSearch
+{
+public:
+	enum { SECTOR_STOPS = 200 }; // orders no bigger than this are better searched whole
+	// locations[0] is the depot and locations[i] delivery i. Road distances come from matrix, or
+	// if it's nullptr, are routed on roads for each table as it's made; crow-flies if both are
+	// nullptr. Where there's no table, as between sectors, distances are crow-flies unless there's a matrix.
+	ClusterSearch(const std::vector<GeoCoord>& locations, const DistanceMatrix* matrix, const StreetMap* roads = nullptr);
+	// Replaces order (delivery numbers) with the trip found as above and returns the number of moves made
+	long long improve(std::vector<int>& order, SearchBudget& budget);
+	long long iterations() const { return m_iterations; } // by the last improve
+	// NO_ROUTE if the last improve routed a table between stops that aren't connected, which
+	// leaves its order as it was
+	DeliveryResult result() const { return m_result; }
+	double tripLength(const std::vector<int>& order) const;
+private:
+	enum { SEAM_STOPS = 30 }; // stops re-searched on each side of a seam
+	const std::vector<GeoCoord>& m_locations;
+	const DistanceMatrix* m_matrix;
+	const StreetMap* m_roads;
+	long long m_iterations;
+	DeliveryResult m_result;
+
+	double distance(int a, int b) const { return StopDistances::between(m_locations, m_matrix, a, b); }
+	// The table for stops, routing them first if that's where distances come from; sets result
+	// to NO_ROUTE if some of them aren't connected
+	StopDistances distances(const std::vector<int>& stops, DeliveryResult& result) const;
+	// Splits the deliveries into sectors along a Hilbert curve over their bounding box
+	std::vector<std::vector<int>> sectors() const;
+	// Tours the given locations as a closed loop, starting from stops[0]; adds to moves and iterations
+	std::vector<int> tour(const std::vector<int>& stops, SearchBudget& budget, long long& moves, long long& iterations,
+		DeliveryResult& result) const;
+	// Re-searches cycle[first .. first + count - 1] (positions wrap around) between its two fixed neighbors
+	void repair(std::vector<int>& cycle, int first, int count, SearchBudget& budget, long long& moves, long long& iterations,
+		DeliveryResult& result) const;
+};
+
+#endif
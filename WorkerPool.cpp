@@ -0,0 +1,133 @@
+// WorkerPool.cpp
+
+#include "WorkerPool.h"
+using namespace std;
+
+namespace
+{
+	// Set on pool threads, and on a caller while it's inside run(), so nested runs go inline
+	thread_local bool t_inPool = false;
+
+	// Marks the caller as inside run() for as long as it's working on the batch,
+	// including when it leaves by an exception
+	struct InPool
+	{
+		InPool() { t_inPool = true; }
+		~InPool() { t_inPool = false; }
+	};
+}
+
+WorkerPool::WorkerPool(unsigned int threads)
+	: m_task(nullptr), m_count(0), m_next(0), m_busy(0), m_batch(0), m_stop(false)
+{
+	if (threads == 0) {
+		threads = thread::hardware_concurrency();
+	}
+	// The caller is one of the threads
+	for (unsigned int i = 1; i < threads; ++i) {
+		m_threads.push_back(thread(&WorkerPool::workerLoop, this, i));
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (size_t i = 0; i < m_threads.size(); ++i) {
+		m_threads[i].join();
+	}
+}
+
+WorkerPool& WorkerPool::shared()
+{
+	static WorkerPool pool;
+	return pool;
+}
+
+// Publishes the batch, works on it with everyone else, then waits for stragglers
+void WorkerPool::run(unsigned int count, const function<void(unsigned int, unsigned int)>& task)
+{
+	if (count == 0) {
+		return;
+	}
+	// Nested or single-threaded: just loop here
+	if (t_inPool || m_threads.empty() || count == 1) {
+		for (unsigned int i = 0; i < count; ++i) {
+			task(i, 0);
+		}
+		return;
+	}
+
+	lock_guard<mutex> runLock(m_runMutex);
+	{
+		lock_guard<mutex> lock(m_mutex);
+		m_task = &task;
+		m_count = count;
+		m_next = 0;
+		m_busy = (unsigned int)m_threads.size();
+		++m_batch;
+	}
+	m_wake.notify_all();
+
+	{
+		InPool inPool;
+		drain(0);
+	}
+
+	unique_lock<mutex> lock(m_mutex);
+	m_done.wait(lock, [this] { return m_busy == 0; });
+	m_task = nullptr;
+	// Every thread has left the batch, so a failed task can be reported to the caller
+	if (m_error) {
+		exception_ptr error = m_error;
+		m_error = nullptr;
+		rethrow_exception(error);
+	}
+}
+
+void WorkerPool::workerLoop(unsigned int worker)
+{
+	t_inPool = true;
+	unsigned int seen = 0;
+	for (;;) {
+		{
+			unique_lock<mutex> lock(m_mutex);
+			m_wake.wait(lock, [this, seen] { return m_stop || m_batch != seen; });
+			if (m_stop) {
+				return;
+			}
+			seen = m_batch;
+		}
+		drain(worker);
+		{
+			lock_guard<mutex> lock(m_mutex);
+			--m_busy;
+		}
+		m_done.notify_one();
+	}
+}
+
+void WorkerPool::drain(unsigned int worker)
+{
+	for (;;) {
+		unsigned int i = m_next.fetch_add(1);
+		if (i >= m_count) {
+			return;
+		}
+		try {
+			(*m_task)(i, worker);
+		}
+		catch (...) {
+			// Keep the first failure for run() to rethrow, and hand out no more tasks
+			lock_guard<mutex> lock(m_mutex);
+			if (!m_error) {
+				m_error = current_exception();
+			}
+			m_next = m_count;
+			return;
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#ifndef WP_H_
+#define WP_H_
+
+// WorkerPool.h
+
+// Fixed set of worker threads for running a batch of independent tasks.
+// run(count, task) calls task(i, worker) for every i from 0 to count - 1 and
+// returns once all of them are done. worker is a number from 0 to workerCount() - 1
+// that no other task is using at the same time, so callers can keep one piece of
+// search state per worker and index it with that number. The calling thread
+// works on the batch too.
+// A run() from inside a task simply runs its batch on the calling thread, so
+// components built on the pool can be used from within other pooled tasks.
+// Tasks are handed out from one shared counter: each thread claims the next
+// unstarted task when it finishes one, so uneven tasks still spread evenly.
+// If a task throws, no further tasks are started; run() waits for the ones
+// already running and then rethrows the first exception on the calling thread.
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+
+class WorkerPool
+{
+public:
+	// threads is the total number of threads working on a batch, including the caller;
+	// 0 means one per hardware thread
+	WorkerPool(unsigned int threads = 0);
+	~WorkerPool(); // waits for the worker threads to exit
+	unsigned int workerCount() const { return (unsigned int)m_threads.size() + 1; }
+
+	void run(unsigned int count, const std::function<void(unsigned int task, unsigned int worker)>& task);
+
+	// Pool shared by the planner components, sized to the machine
+	static WorkerPool& shared();
+
+	// We prevent a WorkerPool object from being copied or assigned.
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+private:
+	std::vector<std::thread> m_threads;
+	std::mutex m_runMutex; // one batch at a time
+	std::mutex m_mutex; // guards everything below
+	std::condition_variable m_wake, m_done;
+	const std::function<void(unsigned int, unsigned int)>* m_task;
+	unsigned int m_count;
+	std::atomic<unsigned int> m_next; // next task to hand out
+	unsigned int m_busy; // workers still inside the current batch
+	unsigned int m_batch; // incremented for each batch so workers can tell it's new
+	bool m_stop;
+	std::exception_ptr m_error; // first exception thrown by a task in the current batch
+
+	void workerLoop(unsigned int worker);
+	// Takes tasks from the current batch until there are none left or one has thrown
+	void drain(unsigned int worker);
+};
+
+#endif
@@ -22,11 +22,27 @@
 using namespace std;
 
 
-int main() {
+int main(int argc, char* argv[]) {
 
-	// Initialize our StreetMap with the geocoordinates for Westwood
+	// "P4 --snapshot mapdata.txt mapdata.snap" converts a map file into a binary snapshot and exits
+	if (argc == 4 && string(argv[1]) == "--snapshot") {
+		StreetMap sm;
+		if (!sm.load(argv[2]) || !sm.saveSnapshot(argv[3])) {
+			return 1;
+		}
+		return 0;
+	}
+
+	// Initialize our StreetMap with the geocoordinates for Westwood, from a snapshot if one was given
 	StreetMap sm;
-	sm.load("mapdata.txt");
+	if (argc == 2) {
+		if (!sm.loadSnapshot(argv[1])) {
+			return 1;
+		}
+	}
+	else {
+		sm.load("mapdata.txt");
+	}
 
 	// Geocoordinates for our depot and delivery stops...
 	GeoCoord depot("34.0625329", "-118.4470263");
@@ -8,6 +8,8 @@
 #include <string>
 #include <vector>
 #include <list>
+#include <atomic>
+#include <functional>
 
 enum DeliveryResult
 {
@@ -72,6 +74,14 @@ bool operator==(const StreetSegment& lhs, const StreetSegment& rhs)
 }
 
 class StreetMapImpl;
+class StreetGraph;
+class ContractionHierarchy;
+class LandmarkTable;
+class RouteCache;
+class SpatialIndex;
+enum LandmarkStrategy : int; // see LandmarkTable.h
+struct MapLoadStats; // see MapParser.h
+struct StreetEdgeRef; // see StreetGraph.h
 
 class StreetMap
 {
@@ -79,7 +89,37 @@ public:
 	StreetMap();
 	~StreetMap();
 	bool load(std::string mapFile);
+	// Sizes and timings of the last load
+	MapLoadStats lastLoadStats() const;
 	bool getSegmentsThatStartWith(const GeoCoord& gc, std::vector<StreetSegment>& segs) const;
+	// The same segments, in the same order, without building any StreetSegments: visit is called
+	// with each one as the map stores it. False if gc isn't a vertex of the map.
+	bool visitSegmentsThatStartWith(const GeoCoord& gc, const std::function<void(const StreetEdgeRef&)>& visit) const;
+	// Binary snapshot of the loaded map that loadSnapshot can map straight into memory
+	bool saveSnapshot(std::string snapshotFile) const;
+	bool loadSnapshot(std::string snapshotFile);
+	// Read-only CSR view of the loaded map (see StreetGraph.h)
+	const StreetGraph* graph() const;
+	// Preprocesses the loaded map for ROUTER_CONTRACTION_HIERARCHY; loading a map discards it
+	void buildContractionHierarchy();
+	// The hierarchy built for the current map, or nullptr if there isn't one
+	const ContractionHierarchy* contractionHierarchy() const;
+	// Landmark distance tables that tighten the A* heuristic; loading a map discards them.
+	// The first form picks them with LANDMARKS_AVOID.
+	void buildLandmarks(unsigned int count = 16);
+	void buildLandmarks(unsigned int count, LandmarkStrategy strategy);
+	bool saveLandmarks(std::string landmarkFile) const;
+	bool loadLandmarks(std::string landmarkFile);
+	// The landmarks for the current map, or nullptr if there aren't any
+	const LandmarkTable* landmarks() const;
+	// Route cache shared by everything routing on this map (see RouteCache.h); loading a map empties it
+	RouteCache* routeCache() const;
+	// Snapping: the map vertex, or the point on a street segment, nearest gc and no more than
+	// radiusMiles away. False if there is none. A snapped point that isn't a vertex isn't routable.
+	bool nearestNode(const GeoCoord& gc, double radiusMiles, GeoCoord& node) const;
+	bool nearestPointOnSegment(const GeoCoord& gc, double radiusMiles, GeoCoord& point, StreetSegment& segment) const;
+	// Index behind the snapping queries, built whenever a map is loaded (see SpatialIndex.h)
+	const SpatialIndex* spatialIndex() const;
 	// We prevent a StreetMap object from being copied or assigned.
 	StreetMap(const StreetMap&) = delete;
 	StreetMap& operator=(const StreetMap&) = delete;
@@ -88,6 +128,7 @@ private:
 };
 
 class PointToPointRouterImpl;
+enum RouterMode : int; // see RouterMode.h
 
 class PointToPointRouter
 {
@@ -99,6 +140,18 @@ public:
 		const GeoCoord& end,
 		std::list<StreetSegment>& route,
 		double& totalDistanceTravelled) const;
+	// The same route as edge IDs of StreetMap::graph(), the first one leaving start's node,
+	// without building any StreetSegments
+	DeliveryResult generatePointToPointPath(
+		const GeoCoord& start,
+		const GeoCoord& end,
+		std::vector<unsigned int>& edges,
+		double& totalDistanceTravelled) const;
+	void setMode(RouterMode mode);
+	RouterMode mode() const;
+	// Looks routes up in cache before searching and adds the ones it finds; nullptr (the default) turns caching off
+	void setCache(RouteCache* cache);
+	RouteCache* cache() const;
 	// We prevent a PointToPointRouter object from being copied or assigned.
 	PointToPointRouter(const PointToPointRouter&) = delete;
 	PointToPointRouter& operator=(const PointToPointRouter&) = delete;
@@ -116,6 +169,9 @@ struct DeliveryRequest
 };
 
 class DeliveryOptimizerImpl;
+class DistanceMatrix; // see DistanceMatrix.h
+enum OptimizerEngine : int; // see OptimizerEngine.h
+struct OptimizerReport;
 
 class DeliveryOptimizer
 {
@@ -127,6 +183,42 @@ public:
 		std::vector<DeliveryRequest>& deliveries,
 		double& oldCrowDistance,
 		double& newCrowDistance) const;
+	// Same, but on road distances: matrix holds the depot at index 0 and
+	// deliveries[i] at index i + 1, in the order deliveries are passed in
+	void optimizeDeliveryOrder(
+		const GeoCoord& depot,
+		std::vector<DeliveryRequest>& deliveries,
+		const DistanceMatrix& matrix,
+		double& oldDistance,
+		double& newDistance) const;
+	// Same on road distances routed on sm's map, only between the stops the search compares: a
+	// table of every pair, or with OPTIMIZER_CLUSTERED and over 200 deliveries (one sector)
+	// just a table per sector and per seam. Returns BAD_COORD if a location isn't on the map
+	// and NO_ROUTE if two stops it compares aren't connected, leaving deliveries as they were.
+	// Clustered trips are never measured whole, so lastReport() gives them in crow-flies miles.
+	DeliveryResult optimizeDeliveryOrderByRoad(
+		const GeoCoord& depot,
+		std::vector<DeliveryRequest>& deliveries) const;
+	void setEngine(OptimizerEngine engine);
+	OptimizerEngine engine() const;
+	// The engines give the same order every time for the same seed (1 by default) and, for
+	// OPTIMIZER_PARALLEL_TEMPERING, number of chains; 0 chains (the default) means one per worker pool thread
+	void setSeed(unsigned int seed);
+	void setChains(unsigned int chains);
+	// Orders of up to this many deliveries (12 by default, 16 at most) get a provably
+	// shortest order by dynamic programming, whatever the engine; 0 turns that off
+	void setExactLimit(int deliveries);
+	// Budget for each call. It stops at the deadline (milliseconds after the call starts) or
+	// after this many iterations, whichever comes first, and keeps the best order found
+	// until then. 0 means no limit. Exact solves take at most a few tens of milliseconds
+	// and aren't cut short.
+	void setDeadline(double milliseconds);
+	void setIterationLimit(long long iterations);
+	// Another thread can set *cancel to stop a call early in the same way; nullptr (the default) for none
+	void setCancelFlag(const std::atomic<bool>* cancel);
+	// Called from the optimizing thread every so often during a call with the progress so far; empty for none
+	void setProgressCallback(const std::function<void(const OptimizerReport&)>& progress);
+	OptimizerReport lastReport() const;
 	// We prevent a DeliveryOptimizer object from being copied or assigned.
 	DeliveryOptimizer(const DeliveryOptimizer&) = delete;
 	DeliveryOptimizer& operator=(const DeliveryOptimizer&) = delete;
@@ -225,6 +317,8 @@ public:
 		const std::vector<DeliveryRequest>& deliveries,
 		std::vector<DeliveryCommand>& commands,
 		double& totalDistanceTravelled) const;
+	// Engine for ordering the deliveries (see DeliveryOptimizer::setEngine); OPTIMIZER_ANNEALING by default
+	void setEngine(OptimizerEngine engine);
 	// We prevent a DeliveryPlanner object from being copied or assigned.
 	DeliveryPlanner(const DeliveryPlanner&) = delete;
 	DeliveryPlanner& operator=(const DeliveryPlanner&) = delete;